@@ -1,56 +1,139 @@
 #pragma once
 
 #include "Board.hpp"
+#include "LayeredSearch.hpp"
+#include "SearchStats.hpp"
+#include "WorkStealingPool.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
 #include <vector>
-#include <unordered_set>
-
-Board solveBFS(size_t levelNr, Board initialBoard) {
-    std::vector<MoveSequence> queueThis;
-    std::vector<MoveSequence> queueNext;
-    std::unordered_set<uint64_t> seen;
-    queueThis.push_back(initialBoard.moveSequence);
-    size_t steps = 0;
-
-    while (!queueThis.empty()) {
-        MoveSequence sequence = queueThis.back();
-        queueThis.pop_back();
-        Board board = initialBoard;
-        for (size_t i = 0; i < sequence.n; i++) {
-            board.click(sequence.moves[i].row, sequence.moves[i].col);
+
+template<size_t rows, size_t cols>
+struct BfsCandidate {
+    typename Board<rows, cols>::Packed state;
+    uint64_t hash;
+    uint32_t parent; // Index of the state it was reached from
+    uint8_t move; // Clicked cell, row * cols + col
+    bool kept = false; // First of its kind, set by the deduplication
+};
+
+/**
+ * Level-synchronous breadth-first search. Only the states of the current layer are kept, packed.
+ * Every state ever reached keeps its parent index and move, so the solution can be rebuilt.
+ *
+ * Every layer is processed in three steps:
+ * 1. Chunks of the layer are expanded in parallel. Children that earlier layers have already
+ *    seen are dropped, the seen set is only read here. The other children are sorted into
+ *    the shard of the seen set that their hash belongs to.
+ * 2. Shards are deduplicated in parallel. Every shard is only touched by one thread,
+ *    and it goes through the children in chunk order.
+ * 3. The children that are new are appended in chunk order.
+ * Nothing depends on thread timing, so the solution is the same for any number of threads.
+ *
+ * Gives up once the states no longer fit the parent indices, then stats has the status unknown.
+ */
+template<size_t rows, size_t cols>
+Board<rows, cols> solveBFS(size_t levelNr, Board<rows, cols> initialBoard, size_t threads = 1, std::ostream &log = std::cout,
+                           SolveStats *stats = nullptr) {
+    constexpr size_t shardBits = 4;
+    constexpr size_t shards = 1 << shardBits;
+    constexpr size_t chunkSize = 4096;
+    auto finish = [stats](Board<rows, cols> result, SolveStatus status, size_t lowerBound) {
+        if (stats != nullptr) {
+            stats->status = status;
+            stats->lowerBound = lowerBound;
         }
+        return result;
+    };
+    if (initialBoard.isSolved()) {
+        return finish(initialBoard, SolveStatus::OPTIMAL, 0);
+    }
 
-        for (size_t row = 0; row < rows; row++) {
-            for (size_t col = 0; col < cols; col++) {
-                if (!board.fields[row][col].isClickable()) {
-                    continue;
-                }
-                Board newBoard = board;
-                newBoard.click(row, col);
-                if (newBoard.isSolved()) {
-                    return newBoard;
-                } else {
-                    uint64_t code = newBoard.hash();
-                    if (!seen.contains(code)) {
-                        queueNext.push_back(newBoard.moveSequence);
-                        seen.emplace(code);
+    auto parallelFor = [threads](size_t numTasks, const auto &execute) {
+        if (threads > 1) {
+            WorkStealingPool pool(threads);
+            pool.run(numTasks, [&](size_t task, size_t) {
+                execute(task);
+            });
+        } else {
+            for (size_t task = 0; task < numTasks; task++) {
+                execute(task);
+            }
+        }
+    };
+    auto shardOf = [](uint64_t hash) {
+        return hash >> (64 - shardBits);
+    };
+
+    ParentChain chain;
+    std::vector<typename Board<rows, cols>::Packed> layer = {initialBoard.pack()};
+    size_t layerStart = 0; // Index of layer[0] in chain
+    std::vector<HashSet> seen(shards);
+    seen[shardOf(initialBoard.hash())].insert(initialBoard.hash());
+
+    for (size_t steps = 1; steps <= maxSteps; steps++) {
+        size_t numChunks = (layer.size() + chunkSize - 1) / chunkSize;
+        std::vector<std::vector<BfsCandidate<rows, cols>>> candidates(numChunks * shards);
+        std::vector<size_t> solutions(numChunks, SIZE_MAX); // First solved child of the chunk
+        parallelFor(numChunks, [&](size_t chunk) {
+            Board<rows, cols> board = initialBoard;
+            size_t end = std::min(layer.size(), (chunk + 1) * chunkSize);
+            for (size_t i = chunk * chunkSize; i < end; i++) {
+                board.unpack(layer[i]);
+                bool solved = forEachChild(board, [&](size_t cell) {
+                    uint64_t hash = board.hash();
+                    if (board.isSolved()) {
+                        solutions[chunk] = (layerStart + i) * (rows * cols) + cell;
+                        return true;
+                    } else if (!seen[shardOf(hash)].contains(hash)) {
+                        candidates[chunk * shards + shardOf(hash)].push_back(
+                                {board.pack(), hash, uint32_t(layerStart + i), uint8_t(cell)});
                     }
+                    return false;
+                });
+                if (solved) {
+                    return;
                 }
             }
-        }
+        });
 
-        if (queueThis.empty()) {
-            queueThis = queueNext;
-            queueNext.clear();
-            steps++;
+        auto solution = std::find_if(solutions.begin(), solutions.end(), [](size_t s) { return s != SIZE_MAX; });
+        if (solution != solutions.end()) {
+            Board<rows, cols> solved = chain.solution(initialBoard, *solution / (rows * cols), *solution % (rows * cols));
+            return finish(solved, SolveStatus::OPTIMAL, steps);
+        }
 
-            if (steps > 5) {
-                std::cout<<"# Calculating solutions for "<<levelNr<<", currently at "
-                         <<steps<<" steps. Queue length: "<<queueThis.size()<<std::endl;
+        parallelFor(shards, [&](size_t shard) {
+            for (size_t chunk = 0; chunk < numChunks; chunk++) {
+                for (BfsCandidate<rows, cols> &candidate : candidates[chunk * shards + shard]) {
+                    candidate.kept = seen[shard].insert(candidate.hash);
+                }
             }
-            if (steps >= maxSteps) {
-                return {};
+        });
+
+        layerStart = chain.size();
+        layer.clear();
+        for (std::vector<BfsCandidate<rows, cols>> &bucket : candidates) {
+            for (const BfsCandidate<rows, cols> &candidate : bucket) {
+                if (candidate.kept) {
+                    layer.push_back(candidate.state);
+                    chain.push(candidate.parent, candidate.move);
+                }
             }
+            bucket = {};
+        }
+        if (chain.size() > UINT32_MAX) {
+            log<<"# Too many states for "<<levelNr<<std::endl;
+            return finish({}, SolveStatus::UNKNOWN, steps + 1); // Nothing within steps moves, but maybe later
+        }
+        if (layer.empty()) {
+            return finish({}, SolveStatus::UNSOLVABLE, maxSteps + 1);
+        }
+        if (steps > 5) {
+            log<<"# Calculating solutions for "<<levelNr<<", currently at "
+               <<steps<<" steps. Queue length: "<<layer.size()<<std::endl;
         }
     }
-    return {};
+    return finish({}, SolveStatus::UNSOLVABLE, maxSteps + 1);
 }
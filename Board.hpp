@@ -1,14 +1,109 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <compare>
 #include <cstdint>
 #include <cstddef>
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <vector>
 
 constexpr size_t maxSteps = 40;
-constexpr size_t rows = 8;
-constexpr size_t cols = 6;
+constexpr size_t numColors = 5;
+constexpr size_t maxCells = 64; // Every board has to fit into a 64 bit mask
+
+// Clockwise, so that a rotating arrow turns to (direction + 1) % 4
+enum Direction : size_t {
+    UP = 0,
+    RIGHT = 1,
+    DOWN = 2,
+    LEFT = 3
+};
+
+constexpr uint64_t columnMask(size_t rows, size_t cols, size_t col) {
+    uint64_t mask = 0;
+    for (size_t row = 0; row < rows; row++) {
+        mask |= uint64_t(1) << (row * cols + col);
+    }
+    return mask;
+}
+
+/**
+ * Masks of a board with the given dimensions. Cell (row, col) is stored in bit row * cols + col of all masks.
+ * Everything that depends on the dimensions is a template on them, so that every board size gets
+ * its own constants and loops. main.cpp picks the instantiation once per level.
+ */
+template<size_t rows, size_t cols>
+struct Geometry {
+    static_assert(rows * cols <= maxCells, "Board must fit into a 64 bit mask");
+    static_assert(rows < 15 && cols < 15, "Positions have 4 bits per coordinate, and 15 is POSITION_NONE");
+
+    static constexpr uint64_t ALL_CELLS = (rows * cols == 64) ? ~uint64_t(0) : (uint64_t(1) << (rows * cols)) - 1;
+    static constexpr uint64_t FIRST_COLUMN = columnMask(rows, cols, 0);
+    static constexpr uint64_t LAST_COLUMN = columnMask(rows, cols, cols - 1);
+
+    static constexpr uint64_t cellBit(size_t row, size_t col) {
+        return uint64_t(1) << (row * cols + col);
+    }
+
+    static uint64_t shift(uint64_t mask, size_t direction) {
+        switch (direction) {
+            case UP:
+                return mask >> cols;
+            case DOWN:
+                return (mask << cols) & ALL_CELLS;
+            case LEFT:
+                return (mask & ~FIRST_COLUMN) >> 1;
+            default:
+                return (mask & ~LAST_COLUMN) << 1;
+        }
+    }
+};
+
+/**
+ * Random keys for Zobrist hashing. Every cell contributes the key of its current state:
+ * empty, filled with one of the colors, or a rotating arrow pointing to one of the directions.
+ * 'X' cells and all other clickables never change state and contribute nothing.
+ * Every board size has its own keys, see Board::ZOBRIST.
+ */
+struct ZobristKeys {
+    static constexpr size_t EMPTY = 0;
+    static constexpr size_t FILLED = 1; // + color
+    static constexpr size_t ROTATING = FILLED + numColors; // + direction
+    static constexpr size_t STATES = ROTATING + 4;
+
+    std::array<std::array<uint64_t, maxCells>, STATES> keys = {};
+
+    constexpr explicit ZobristKeys(size_t cells) {
+        uint64_t state = 0x3c6ef372fe94f82b; // SplitMix64
+        for (auto &stateKeys : keys) {
+            for (size_t cell = 0; cell < cells; cell++) {
+                uint64_t &key = stateKeys[cell];
+                state += 0x9e3779b97f4a7c15;
+                uint64_t z = state;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+                key = z ^ (z >> 31);
+            }
+        }
+    }
+
+    /**
+     * XOR of the keys of all given cells in the given state.
+     */
+    [[nodiscard]] constexpr uint64_t of(size_t state, uint64_t cells) const {
+        uint64_t hash = 0;
+        while (cells) {
+            hash ^= keys[state][std::countr_zero(cells)];
+            cells &= cells - 1;
+        }
+        return hash;
+    }
+};
+
 
 struct Position {
     union {
@@ -30,99 +125,316 @@ struct Position {
     bool operator !=(const Position &other) const {
         return both != other.both;
     }
+
+    bool operator ==(const Position &other) const {
+        return both == other.both;
+    }
 };
 
 static constexpr Position POSITION_NONE(15, 15);
 
-struct Field {
-    private:
-        char color = 'g';
-        char modifier = '0';
-    public:
-        Position onlyReachableFrom = POSITION_NONE;
+struct MoveSequence {
+    Position moves[maxSteps];
+    size_t n = 0;
 
-        [[nodiscard]] bool isClickable() const {
-            char m = getModifier();
-            return isStaticArrow() || isRotatingArrow() || m == 'F' || m == 'B';
+    [[nodiscard]] std::string toString() const {
+        std::string sequence = "";
+        for (size_t i = 0; i < n; i++) {
+            sequence += ('A' + moves[i].col);
+            sequence += std::to_string(moves[i].row + 1);
+            if (i != n - 1) {
+                sequence += ",";
+            }
         }
+        return sequence;
+    }
+};
 
-        [[nodiscard]] bool isStaticArrow() const {
-            char m = getModifier();
-            return m == 'L' || m == 'R' || m == 'U' || m == 'D';
-        }
+/**
+ * What Board::make() needs to remember so that Board::unmake() can take a click back.
+ * Arrows and floods only move cells between empty and the clicked color (and maybe turn the
+ * clicked arrow), so the toggled cells are enough. Bombs overwrite arbitrary states and keep
+ * a copy of the previous masks instead.
+ */
+struct Undo {
+    uint64_t clicked = 0;
+    uint64_t zobrist = 0;
+    uint64_t toggled = 0;
+    size_t color = 0;
+    size_t rotatedFrom = 4; // Direction of the clicked arrow before the click, 4 if it does not rotate
+    bool bomb = false;
+    uint64_t empty = 0;
+    uint64_t filled[numColors]; // Only for bombs
+    uint64_t rotating[4]; // Only for bombs
+};
+
+/**
+ * Everything a click can change. Cells get a 4 bit code, 1 + their ZobristKeys state, or 0 if they
+ * are 'X' or an intact clickable. Bit b of all codes forms plane b, with one bit per cell, and the
+ * 4 planes are stored one after the other. 8x6 boards need 24 bytes, 6x5 boards 16.
+ */
+template<size_t cells>
+struct PackedBoard {
+    uint64_t words[(4 * cells + 63) / 64] = {};
+
+    auto operator <=>(const PackedBoard &other) const = default;
+};
+
+/**
+ * Everything about a level that no click can change. Boards only keep a pointer to it,
+ * so it has to outlive all boards created from it.
+ */
+template<size_t rows, size_t cols>
+struct BoardLayout {
+    char colors[rows][cols] = {};
+    uint64_t cells = 0; // Everything but 'X'
+    uint64_t targets[numColors] = {}; // Cells that need to end up filled with the given color
+    uint64_t targetCells = 0; // Cells of all targets
+    uint64_t clickables = 0; // Cells that started out as arrow, flood or bomb
+    uint64_t staticArrows[4] = {}; // By Direction
+    uint64_t rotatingArrows = 0;
+    uint64_t floods = 0;
+    uint64_t bombs = 0;
+    Position onlyReachableFrom[rows][cols];
+    bool hasBombs = false;
+
+    /**
+     * A clickable that is the only way to fill some cells, grouped by the Direction they are in.
+     * Only rotating arrows care about the direction, see minStepsNeeded().
+     */
+    struct SingleSource {
+        Position position;
+        uint64_t cells = 0;
+        uint64_t byDirection[4] = {};
+    };
+    SingleSource singleSources[rows * cols];
+    size_t numSingleSources = 0;
+    uint64_t onlyReachable = 0; // Cells of all singleSources
+    uint8_t singleSourceOf[rows * cols] = {}; // Index into singleSources, for cells in onlyReachable
+
+    uint64_t footprints[rows * cols] = {}; // Cells that a click of the cell can look at or change
+    uint64_t commutesBefore[rows * cols] = {}; // Clickables before the cell whose footprints do not overlap
+
+    /**
+     * What Board::apply() needs to know about a clickable, so that it does not have to work it out per click.
+     */
+    struct MoveEffect {
+        uint64_t rays[4] = {}; // Cells from the clickable to the edge of the board, by Direction
+        uint64_t area = 0; // Cells a bomb fills
+        uint64_t neighbors = 0; // Cells a flood starts from
+        uint8_t color = 0;
+        uint8_t staticDirection = 4; // Direction of a static arrow, 4 for anything else
+    };
+    MoveEffect effects[rows * cols];
+};
+
+template<size_t rows, size_t cols>
+struct Board : Geometry<rows, cols> {
+    using Layout = BoardLayout<rows, cols>;
+    using Packed = PackedBoard<rows * cols>;
+    using Geometry<rows, cols>::ALL_CELLS;
+    using Geometry<rows, cols>::cellBit;
+    using Geometry<rows, cols>::shift;
+
+    static constexpr ZobristKeys ZOBRIST = ZobristKeys(rows * cols);
+
+    const Layout *layout = nullptr;
+    uint64_t empty = 0;
+    uint64_t filled[numColors] = {};
+    uint64_t rotating[4] = {}; // Rotating arrows, by the Direction they currently point to
+    uint64_t zobrist = 0; // Maintained by click()
+    MoveSequence moveSequence;
+
+    static constexpr char COLOR_NAMES[numColors + 1] = "rgbod"; // Ordered by colorMPHF
+    static constexpr char STATIC_ARROW_NAMES[5] = "URDL"; // Ordered by Direction
+    static constexpr char ROTATING_ARROW_NAMES[5] = "wxsa"; // Ordered by Direction
+
+    static bool isColor(char c) {
+        return c == 'r' || c == 'g' || c == 'b' || c == 'o' || c == 'd';
+    }
+
+    static size_t colorMPHF(char c) {
+        return c % 6;
+    }
 
-        [[nodiscard]] bool isRotatingArrow() const {
-            char m = getModifier();
-            return m == 'w' || m == 'x' || m == 'a' || m == 's';
+    [[nodiscard]] uint64_t hash() const {
+        return zobrist;
+    }
+
+    [[nodiscard]] uint64_t computeHash() const {
+        uint64_t hash = ZOBRIST.of(ZobristKeys::EMPTY, empty);
+        for (size_t color = 0; color < numColors; color++) {
+            hash ^= ZOBRIST.of(ZobristKeys::FILLED + color, filled[color]);
+        }
+        for (size_t direction = 0; direction < 4; direction++) {
+            hash ^= ZOBRIST.of(ZobristKeys::ROTATING + direction, rotating[direction]);
         }
+        return hash;
+    }
 
-        [[nodiscard]] bool isCorrect() const {
-            if (!isColor(getColor())) {
-                return true;
-            } else if (isColor(getModifier())) {
-                return modifier == color;
-            } else {
-                return getModifier() != '0';
+    [[nodiscard]] Packed pack() const {
+        uint64_t planes[4] = {};
+        auto add = [&](size_t state, uint64_t mask) {
+            for (size_t plane = 0; plane < 4; plane++) {
+                if ((state + 1) & (1 << plane)) {
+                    planes[plane] |= mask;
+                }
             }
+        };
+        add(ZobristKeys::EMPTY, empty);
+        for (size_t color = 0; color < numColors; color++) {
+            add(ZobristKeys::FILLED + color, filled[color]);
         }
-
-        [[nodiscard]] char getModifier() const {
-            return modifier;
+        for (size_t direction = 0; direction < 4; direction++) {
+            add(ZobristKeys::ROTATING + direction, rotating[direction]);
         }
-
-        void setModifier(char modifier_) {
-            modifier = modifier_;
+        Packed packed;
+        for (size_t plane = 0; plane < 4; plane++) {
+            size_t offset = plane * rows * cols;
+            packed.words[offset / 64] |= planes[plane] << (offset % 64);
+            if (offset % 64 + rows * cols > 64) { // Continues in the next word
+                packed.words[offset / 64 + 1] |= planes[plane] >> (64 - offset % 64);
+            }
         }
+        return packed;
+    }
 
-        [[nodiscard]] char getColor() const {
-            return color;
+    /**
+     * Restores the state of pack(). The layout and move sequence stay as they are.
+     */
+    void unpack(const Packed &packed) {
+        uint64_t planes[4];
+        for (size_t plane = 0; plane < 4; plane++) {
+            size_t offset = plane * rows * cols;
+            planes[plane] = packed.words[offset / 64] >> (offset % 64);
+            if (offset % 64 + rows * cols > 64) {
+                planes[plane] |= packed.words[offset / 64 + 1] << (64 - offset % 64);
+            }
+            planes[plane] &= ALL_CELLS;
         }
+        auto cellsIn = [&](size_t state) {
+            uint64_t mask = ALL_CELLS;
+            for (size_t plane = 0; plane < 4; plane++) {
+                mask &= ((state + 1) & (1 << plane)) ? planes[plane] : ~planes[plane];
+            }
+            return mask;
+        };
+        empty = cellsIn(ZobristKeys::EMPTY);
+        for (size_t color = 0; color < numColors; color++) {
+            filled[color] = cellsIn(ZobristKeys::FILLED + color);
+        }
+        for (size_t direction = 0; direction < 4; direction++) {
+            rotating[direction] = cellsIn(ZobristKeys::ROTATING + direction);
+        }
+        zobrist = computeHash();
+    }
 
-        void setColor(char color_) {
-            color = color_;
+    [[nodiscard]] uint64_t filledCells() const {
+        uint64_t mask = 0;
+        for (uint64_t colorMask : filled) {
+            mask |= colorMask;
         }
+        return mask;
+    }
+
+    [[nodiscard]] uint64_t clickableCells() const {
+        return layout->clickables & ~(empty | filledCells());
+    }
 
-        static bool isColor(char c) {
-            return c == 'r' || c == 'g' || c == 'b' || c == 'o' || c == 'd';
+    [[nodiscard]] uint64_t correctCells() const {
+        uint64_t correct = 0;
+        for (size_t color = 0; color < numColors; color++) {
+            correct |= layout->targets[color] & filled[color];
         }
+        return correct;
+    }
+
+    /**
+     * Empty cells and cells with the wrong color. Clickables that are still intact do not count.
+     */
+    [[nodiscard]] uint64_t incorrectCells() const {
+        return layout->targetCells & (empty | filledCells()) & ~correctCells();
+    }
 
-        static size_t colorMPHF(char c) {
-            return c % 6;
+    /**
+     * Bit color is set if the color fills a cell that needs another one.
+     */
+    [[nodiscard]] uint64_t colorsNeedingRemoval() const {
+        uint64_t colors = 0;
+        for (size_t color = 0; color < numColors; color++) {
+            colors |= uint64_t((filled[color] & layout->targetCells & ~layout->targets[color]) != 0) << color;
         }
-};
+        return colors;
+    }
 
-struct MoveSequence {
-    Position moves[maxSteps];
-    size_t n = 0;
+    [[nodiscard]] bool isClickable(size_t row, size_t col) const {
+        return clickableCells() & cellBit(row, col);
+    }
 
-    std::string toString() {
-        std::string sequence = "";
-        for (size_t i = 0; i < n; i++) {
-            sequence += ('A' + moves[i].col);
-            sequence += std::to_string(moves[i].row + 1);
-            if (i != n - 1) {
-                sequence += ",";
+    /**
+     * Direction of the rotating arrow at the given position, or 4 if there is none.
+     */
+    [[nodiscard]] size_t rotatingDirection(size_t row, size_t col) const {
+        for (size_t direction = 0; direction < 4; direction++) {
+            if (rotating[direction] & cellBit(row, col)) {
+                return direction;
             }
         }
-        return sequence;
+        return 4;
     }
-};
 
-struct Board {
-    Field fields[rows][cols] = {};
-    MoveSequence moveSequence;
-    bool hasBombs = false;
+    [[nodiscard]] char getColor(size_t row, size_t col) const {
+        return layout->colors[row][col];
+    }
 
-    [[nodiscard]] uint64_t hash() const {
-        return MurmurHash64(&fields, sizeof(fields));
+    [[nodiscard]] char getModifier(size_t row, size_t col) const {
+        uint64_t bit = cellBit(row, col);
+        if (!(layout->cells & bit)) {
+            return 'X';
+        } else if (empty & bit) {
+            return '0';
+        }
+        for (size_t color = 0; color < numColors; color++) {
+            if (filled[color] & bit) {
+                return COLOR_NAMES[color];
+            }
+        }
+        for (size_t direction = 0; direction < 4; direction++) {
+            if (rotating[direction] & bit) {
+                return ROTATING_ARROW_NAMES[direction];
+            } else if (layout->staticArrows[direction] & bit) {
+                return STATIC_ARROW_NAMES[direction];
+            }
+        }
+        if (layout->floods & bit) {
+            return 'F';
+        } else if (layout->bombs & bit) {
+            return 'B';
+        }
+        return '?';
+    }
+
+    /**
+     * Color string followed by the modifier string of a level file that starts with this board.
+     * Equal boards of equal levels have equal encodings.
+     */
+    [[nodiscard]] std::string encode() const {
+        std::string encoding(2 * rows * cols, '0');
+        for (size_t row = 0; row < rows; row++) {
+            for (size_t col = 0; col < cols; col++) {
+                encoding[row * cols + col] = getColor(row, col);
+                encoding[rows * cols + row * cols + col] = getModifier(row, col);
+            }
+        }
+        return encoding;
     }
 
     std::string toString() {
         std::string description("", rows * (cols + 1) * 2 + 1);
         for (size_t row = 0; row < rows; row++) {
             for (size_t col = 0; col < cols; col++) {
-                description[row * (cols + 1) + col] = fields[row][col].getColor();
-                description[rows * (cols + 1) + 1 + row * (cols + 1) + col] = fields[row][col].getModifier();
+                description[row * (cols + 1) + col] = getColor(row, col);
+                description[rows * (cols + 1) + 1 + row * (cols + 1) + col] = getModifier(row, col);
             }
             description[row * (cols + 1) + cols] = '\n';
             description[rows * (cols + 1) + 1 + row * (cols + 1) + cols] = '\n';
@@ -131,136 +443,145 @@ struct Board {
         return description;
     }
 
-    void print() {
+    void print(std::ostream &out = std::cout) const {
         for (size_t row = 0; row < rows; row++) {
-            std::cout<<"# ";
+            out<<"# ";
             for (size_t col = 0; col < cols; col++) {
-                std::cout<<"\033[0m";
-                if (fields[row][col].getModifier() == 'X') {
-                    std::cout<<"\033[40m   ";
+                out<<"\033[0m";
+                char modifier = getModifier(row, col);
+                if (modifier == 'X') {
+                    out<<"\033[40m   ";
                     continue;
                 }
-                switch (fields[row][col].getColor()) {
+                switch (getColor(row, col)) {
                     case 'r':
-                        std::cout<<"\033[41m";
+                        out<<"\033[41m";
                         break;
                     case 'g':
-                        std::cout<<"\033[42m";
+                        out<<"\033[42m";
                         break;
                     case 'b':
-                        std::cout<<"\033[44m";
+                        out<<"\033[44m";
                         break;
                     case 'o':
-                        std::cout<<"\033[43m";
+                        out<<"\033[43m";
                         break;
                     case 'd':
-                        std::cout<<"\033[45m";
+                        out<<"\033[45m";
                         break;
                     default:
-                        std::cout<<"ERROR";
+                        out<<"ERROR";
                         break;
                 }
-                std::cout<<" ";
-                if (Field::isColor(fields[row][col].getModifier())
-                    && fields[row][col].getModifier() == fields[row][col].getColor()) {
-                    std::cout<<"□";
-                } else if (Field::isColor(fields[row][col].getModifier())) {
-                    switch (fields[row][col].getModifier()) {
+                out<<" ";
+                if (isColor(modifier) && modifier == getColor(row, col)) {
+                    out<<"□";
+                } else if (isColor(modifier)) {
+                    switch (modifier) {
                         case 'r':
-                            std::cout<<"\033[31m";
+                            out<<"\033[31m";
                             break;
                         case 'g':
-                            std::cout<<"\033[32m";
+                            out<<"\033[32m";
                             break;
                         case 'b':
-                            std::cout<<"\033[34m";
+                            out<<"\033[34m";
                             break;
                         case 'o':
-                            std::cout<<"\033[33m";
+                            out<<"\033[33m";
                             break;
                         case 'd':
-                            std::cout<<"\033[35m";
+                            out<<"\033[35m";
                             break;
                         default:
-                            std::cout << "ERROR";
+                            out << "ERROR";
                             break;
                     }
-                    std::cout << "■";
+                    out << "■";
                 } else {
-                    switch (fields[row][col].getModifier()) {
+                    switch (modifier) {
                         case '0':
-                            std::cout << "\033[30m■";
+                            out << "\033[30m■";
                             break;
                         case 'D':
                         case 's':
-                            std::cout << "↓";
+                            out << "↓";
                             break;
                         case 'L':
                         case 'a':
-                            std::cout << "←";
+                            out << "←";
                             break;
                         case 'R':
                         case 'x':
-                            std::cout << "→";
+                            out << "→";
                             break;
                         case 'U':
                         case 'w':
-                            std::cout << "↑";
+                            out << "↑";
                             break;
                         case 'F':
-                            std::cout << "○";
+                            out << "○";
                             break;
                         case 'B':
-                            std::cout << "▲";
+                            out << "▲";
                             break;
                         default:
-                            std::cout << "ERROR";
+                            out << "ERROR";
                             break;
                     }
                 }
-                std::cout<<" ";
-                std::cout<<"\033[0m";
+                out<<" ";
+                out<<"\033[0m";
             }
-            std::cout<<std::endl;
+            out<<std::endl;
         }
     }
 
-    bool fill(int dr, int rc, size_t row, size_t col, char color) {
-        row += dr;
-        col += rc;
-        char from;
-        char to;
-        if (fields[row][col].getModifier() == color) { // Un-fill
-            from = color;
-            to = '0';
-        } else if (fields[row][col].getModifier() == '0') { // Fill
-            from = '0';
-            to = color;
+    /**
+     * Fills (or un-fills) the cells of ray, which starts next to the clicked cell and goes on in
+     * direction. The fill ends at the first cell that is not in the same state as the first one.
+     */
+    bool fill(size_t direction, uint64_t ray, size_t color) {
+        // Cells of rays to the right and down have increasing bits, the others decreasing
+        bool increasing = direction == RIGHT || direction == DOWN;
+        uint64_t next = increasing ? ray & -ray : std::bit_floor(ray);
+        uint64_t *from;
+        uint64_t *to;
+        if (next & filled[color]) { // Un-fill
+            from = &filled[color];
+            to = &empty;
+        } else if (next & empty) { // Fill
+            from = &empty;
+            to = &filled[color];
         } else {
             return false;
         }
-        while (fields[row][col].getModifier() == from && row < rows && col < cols) {
-            fields[row][col].setModifier(to);
-            row += dr;
-            col += rc;
+        uint64_t blocked = ray & ~*from;
+        if (increasing) {
+            ray &= (blocked & -blocked) - 1;
+        } else if (blocked) {
+            ray &= ~(std::bit_floor(blocked) * 2 - 1);
         }
+        *from &= ~ray;
+        *to |= ray;
+        zobrist ^= ZOBRIST.of(ZobristKeys::EMPTY, ray) ^ ZOBRIST.of(ZobristKeys::FILLED + color, ray);
         return true;
     }
 
-    bool flood(size_t row, size_t col, char from, char to) {
-        if (row >= rows || col >= cols) {
-            return false;
-        }
-        if (fields[row][col].getModifier() == from) {
-            fields[row][col].setModifier(to);
-            flood(row + 1, col, from, to);
-            flood(row - 1, col, from, to);
-            flood(row, col + 1, from, to);
-            flood(row, col - 1, from, to);
-            return true;
-        } else {
-            return false;
+    /**
+     * Moves the cells of from that are connected to start through cells of from over to to.
+     * The region grows by all of its neighbors at once, until it stops changing.
+     */
+    static uint64_t flood(uint64_t start, uint64_t &from, uint64_t &to) {
+        uint64_t region = start & from;
+        uint64_t previous = 0;
+        while (region != previous) {
+            previous = region;
+            region |= (shift(region, UP) | shift(region, RIGHT) | shift(region, DOWN) | shift(region, LEFT)) & from;
         }
+        from &= ~region;
+        to |= region;
+        return region;
     }
 
     bool click(size_t row, size_t col) {
@@ -268,77 +589,111 @@ struct Board {
         moveSequence.moves[moveSequence.n].row = row;
         moveSequence.n++;
 
-        Field &field = fields[row][col];
-        if (field.getModifier() == 'U') {
-            return fill(-1, 0, row, col, field.getColor());
-        } else if (field.getModifier() == 'D') {
-            return fill(1, 0, row, col, field.getColor());
-        } else if (field.getModifier() == 'L') {
-            return fill(0, -1, row, col, field.getColor());
-        } else if (field.getModifier() == 'R') {
-            return fill(0, 1, row, col, field.getColor());
-        } else if (field.getModifier() == 'F') {
-            char from = '0';
-            char to = field.getColor();
-            bool somethingFilled = false;
-            somethingFilled |= flood(row + 1, col, from, to);
-            somethingFilled |= flood(row - 1, col, from, to);
-            somethingFilled |= flood(row, col + 1, from, to);
-            somethingFilled |= flood(row, col - 1, from, to);
-
-            if (!somethingFilled) {
-                from = field.getColor();
-                to = '0';
-                somethingFilled |= flood(row + 1, col, from, to);
-                somethingFilled |= flood(row - 1, col, from, to);
-                somethingFilled |= flood(row, col + 1, from, to);
-                somethingFilled |= flood(row, col - 1, from, to);
-            }
-            return somethingFilled;
-        } else if (field.getModifier() == 'B') {
-            char color = field.getColor();
-            for (size_t dr = 0; dr < 3; dr++) {
-                for (size_t dc = 0; dc < 3; dc++) {
-                    if (row - 1 + dr < rows && col - 1 + dc < cols) {
-                        Field &f = fields[row - 1 + dr][col - 1 + dc];
-                        if (f.getModifier() != 'X') {
-                            f.setModifier(color);
-                        }
-                    }
-                }
+        bool somethingChanged = apply(row, col);
+#ifdef DEBUG_CHECKS
+        if (zobrist != computeHash()) {
+            std::cout<<"Incremental hash differs after clicking "<<moveSequence.toString()<<std::endl;
+            exit(1);
+        }
+#endif
+        return somethingChanged;
+    }
+
+    /**
+     * Performs the click in place without recording it in the move sequence.
+     * Everything needed to take it back with unmake() is stored in undo.
+     */
+    bool make(size_t row, size_t col, Undo &undo) {
+        uint64_t bit = cellBit(row, col);
+        undo.clicked = bit;
+        undo.zobrist = zobrist;
+        undo.empty = empty;
+        undo.bomb = layout->bombs & bit;
+        if (undo.bomb) {
+            std::copy(std::begin(filled), std::end(filled), undo.filled);
+            std::copy(std::begin(rotating), std::end(rotating), undo.rotating);
+        } else {
+            undo.color = layout->effects[row * cols + col].color;
+            undo.rotatedFrom = rotatingDirection(row, col);
+        }
+        bool somethingChanged = apply(row, col);
+        undo.toggled = empty ^ undo.empty;
+#ifdef DEBUG_CHECKS
+        if (zobrist != computeHash()) {
+            std::cout<<"Incremental hash differs after clicking "<<row<<","<<col<<std::endl;
+            exit(1);
+        }
+#endif
+        return somethingChanged;
+    }
+
+    void unmake(const Undo &undo) {
+        if (undo.bomb) {
+            empty = undo.empty;
+            std::copy(std::begin(undo.filled), std::end(undo.filled), filled);
+            std::copy(std::begin(undo.rotating), std::end(undo.rotating), rotating);
+        } else {
+            empty ^= undo.toggled;
+            filled[undo.color] ^= undo.toggled;
+            if (undo.rotatedFrom < 4) {
+                rotating[(undo.rotatedFrom + 1) % 4] &= ~undo.clicked;
+                rotating[undo.rotatedFrom] |= undo.clicked;
             }
+        }
+        zobrist = undo.zobrist;
+    }
+
+    /**
+     * Performs the click without recording it in the move sequence.
+     */
+    bool apply(size_t row, size_t col) {
+        uint64_t bit = cellBit(row, col);
+        if (!(clickableCells() & bit)) {
+            std::cout<<"Unknown modifier"<<std::endl;
+            return false;
+        }
+        const typename Layout::MoveEffect &effect = layout->effects[row * cols + col];
+        size_t color = effect.color;
+        if (effect.staticDirection < 4) {
+            return fill(effect.staticDirection, effect.rays[effect.staticDirection], color);
+        } else if (layout->rotatingArrows & bit) {
+            size_t direction = rotatingDirection(row, col);
+            fill(direction, effect.rays[direction], color);
+            rotating[direction] &= ~bit;
+            rotating[(direction + 1) % 4] |= bit;
+            zobrist ^= ZOBRIST.of(ZobristKeys::ROTATING + direction, bit)
+                       ^ ZOBRIST.of(ZobristKeys::ROTATING + (direction + 1) % 4, bit);
             return true;
-        } else if (field.getModifier() == 'w') {
-            fill(-1, 0, row, col, field.getColor());
-            field.setModifier('x');
-            return true;
-        } else if (field.getModifier() == 's') {
-            fill(1, 0, row, col, field.getColor());
-            field.setModifier('a');
-            return true;
-        } else if (field.getModifier() == 'a') {
-            fill(0, -1, row, col, field.getColor());
-            field.setModifier('w');
-            return true;
-        } else if (field.getModifier() == 'x') {
-            fill(0, 1, row, col, field.getColor());
-            field.setModifier('s');
+        }
+        if (layout->floods & bit) {
+            // Fills the empty cells around it, or if there are none, empties the ones of its color
+            uint64_t changed = flood(effect.neighbors, empty, filled[color]);
+            if (!changed) {
+                changed = flood(effect.neighbors, filled[color], empty);
+            }
+            zobrist ^= ZOBRIST.of(ZobristKeys::EMPTY, changed) ^ ZOBRIST.of(ZobristKeys::FILLED + color, changed);
+            return changed != 0;
+        } else { // Bomb
+            uint64_t area = effect.area;
+            zobrist ^= ZOBRIST.of(ZobristKeys::EMPTY, empty & area);
+            empty &= ~area;
+            for (size_t c = 0; c < numColors; c++) {
+                zobrist ^= ZOBRIST.of(ZobristKeys::FILLED + c, filled[c] & area);
+                filled[c] &= ~area;
+            }
+            for (size_t direction = 0; direction < 4; direction++) {
+                zobrist ^= ZOBRIST.of(ZobristKeys::ROTATING + direction, rotating[direction] & area);
+                rotating[direction] &= ~area;
+            }
+            filled[color] |= area;
+            zobrist ^= ZOBRIST.of(ZobristKeys::FILLED + color, area);
             return true;
-        } else {
-            std::cout<<"Unknown modifier"<<std::endl;
         }
-        return false;
     }
 
     [[nodiscard]] bool isSolved() const {
-        for (auto & row : fields) {
-            for (auto & field : row) {
-                if (!field.isCorrect()) {
-                    return false;
-                }
-            }
-        }
-        return true;
+        // Default-constructed boards are used as "no solution" placeholders
+        return layout != nullptr && incorrectCells() == 0;
     }
 
     bool click(const char *string) {
@@ -347,12 +702,12 @@ struct Board {
 
     using ReachabilityArray = std::vector<Position>[rows][cols];
 
-    static void fillReachability(int dr, int rc, const size_t row, const size_t col, char color, Board &b,
-                                 ReachabilityArray &reachableFrom) {
+    static void fillReachability(int dr, int rc, const size_t row, const size_t col, char color,
+                                 const Layout &layout, ReachabilityArray &reachableFrom) {
         size_t r = row + dr;
         size_t c = col + rc;
         while (r < rows && c < cols) {
-            if (b.fields[r][c].getColor() == color) {
+            if (layout.colors[r][c] == color) {
                 reachableFrom[r][c].emplace_back(row, col);
             }
             r += dr;
@@ -360,76 +715,227 @@ struct Board {
         }
     }
 
-    static Board from(std::string color, std::string modifier) {
-        Board initialBoard;
-        bool smallBoard = color.length() == 5 * 6;
-        for (size_t row = 0; row < rows; row++) {
-            for (size_t col = 0; col < cols; col++) {
-                Field &field = initialBoard.fields[row][col];
-                if (smallBoard && (row >= 6 || col >= 5)) {
-                    field.setColor('0');
-                    field.setModifier('X');
-                    continue;
-                }
-                field.setColor(color[row * (smallBoard ? 5 : 6) + col]);
-                field.setModifier(modifier[row * (smallBoard ? 5 : 6) + col]);
-            }
-        }
-
-        // Fill reachability
-        ReachabilityArray reachableFrom;
+    /**
+     * Lists every clickable that can fill a cell with the cell's color, for every cell.
+     */
+    static void computeReachability(const Layout &layout, ReachabilityArray &reachableFrom) {
         for (size_t row = 0; row < rows; row++) {
             for (size_t col = 0; col < cols; col++) {
-                Field &field = initialBoard.fields[row][col];
-                if (!field.isClickable()) {
+                uint64_t bit = cellBit(row, col);
+                if (!(layout.clickables & bit)) {
                     continue;
                 }
-
-                if (field.getModifier() == 'U') {
-                    fillReachability(-1, 0, row, col, field.getColor(), initialBoard, reachableFrom);
-                } else if (field.getModifier() == 'D') {
-                    fillReachability(1, 0, row, col, field.getColor(), initialBoard, reachableFrom);
-                } else if (field.getModifier() == 'L') {
-                    fillReachability(0, -1, row, col, field.getColor(), initialBoard, reachableFrom);
-                } else if (field.getModifier() == 'R') {
-                    fillReachability(0, 1, row, col, field.getColor(), initialBoard, reachableFrom);
-                } else if (field.getModifier() == 'F') {
+                char color = layout.colors[row][col];
+
+                if (layout.staticArrows[UP] & bit) {
+                    fillReachability(-1, 0, row, col, color, layout, reachableFrom);
+                } else if (layout.staticArrows[DOWN] & bit) {
+                    fillReachability(1, 0, row, col, color, layout, reachableFrom);
+                } else if (layout.staticArrows[LEFT] & bit) {
+                    fillReachability(0, -1, row, col, color, layout, reachableFrom);
+                } else if (layout.staticArrows[RIGHT] & bit) {
+                    fillReachability(0, 1, row, col, color, layout, reachableFrom);
+                } else if (layout.floods & bit) {
                     for (size_t r = 0; r < rows; r++) {
                         for (size_t c = 0; c < cols; c++) {
-                            if (initialBoard.fields[r][c].getColor() == field.getColor()) {
+                            if (layout.colors[r][c] == color) {
                                 reachableFrom[r][c].emplace_back(row, col);
                             }
                         }
                     }
-                } else if (field.getModifier() == 'B') {
-                    initialBoard.hasBombs = true;
+                } else if (layout.bombs & bit) {
                     for (size_t dr = 0; dr < 3; dr++) {
                         for (size_t dc = 0; dc < 3; dc++) {
-                            if (row - 1 + dr <= rows && col - 1 + dc <= cols) {
-                                if (initialBoard.fields[row - 1 + dr][col - 1 + dc].getColor() == field.getColor()) {
+                            if (row - 1 + dr < rows && col - 1 + dc < cols) {
+                                if (layout.colors[row - 1 + dr][col - 1 + dc] == color) {
                                     reachableFrom[row - 1 + dr][col - 1 + dc].emplace_back(row, col);
                                 }
                             }
                         }
                     }
-                } else if (field.getModifier() == 'w' || field.getModifier() == 's'
-                           || field.getModifier() == 'a' || field.getModifier() == 'x') {
-                    fillReachability(-1, 0, row, col, field.getColor(), initialBoard, reachableFrom);
-                    fillReachability(1, 0, row, col, field.getColor(), initialBoard, reachableFrom);
-                    fillReachability(0, -1, row, col, field.getColor(), initialBoard, reachableFrom);
-                    fillReachability(0, 1, row, col, field.getColor(), initialBoard, reachableFrom);
+                } else { // Rotating arrow
+                    fillReachability(-1, 0, row, col, color, layout, reachableFrom);
+                    fillReachability(1, 0, row, col, color, layout, reachableFrom);
+                    fillReachability(0, -1, row, col, color, layout, reachableFrom);
+                    fillReachability(0, 1, row, col, color, layout, reachableFrom);
+                }
+            }
+        }
+    }
+
+    /**
+     * Clicks with disjoint footprints give the same board in either order. Footprints only depend
+     * on the level, so they err on the large side: rays go on to the next 'X' and floods cover
+     * everything they could spread to, or the whole board if bombs can open up clickables.
+     */
+    static void computeFootprints(Layout &layout) {
+        uint64_t clickables = layout.clickables;
+        while (clickables) {
+            size_t cell = std::countr_zero(clickables);
+            clickables &= clickables - 1;
+            uint64_t bit = uint64_t(1) << cell;
+            uint64_t footprint = bit;
+            for (size_t direction = 0; direction < 4; direction++) {
+                if ((layout.staticArrows[direction] | layout.rotatingArrows) & bit) {
+                    for (uint64_t next = shift(bit, direction) & layout.cells; next; next = shift(next, direction) & layout.cells) {
+                        footprint |= next;
+                    }
+                }
+            }
+            if ((layout.floods & bit) && layout.hasBombs) {
+                footprint = ALL_CELLS;
+            } else if (layout.floods & bit) {
+                uint64_t passable = layout.cells & ~layout.clickables;
+                uint64_t region = (shift(bit, UP) | shift(bit, RIGHT) | shift(bit, DOWN) | shift(bit, LEFT)) & passable;
+                uint64_t previous = 0;
+                while (region != previous) {
+                    previous = region;
+                    region |= (shift(region, UP) | shift(region, RIGHT) | shift(region, DOWN) | shift(region, LEFT)) & passable;
+                }
+                footprint |= region;
+            } else if (layout.bombs & bit) {
+                uint64_t row = bit | shift(bit, LEFT) | shift(bit, RIGHT);
+                footprint |= (row | shift(row, UP) | shift(row, DOWN)) & layout.cells;
+            }
+            layout.footprints[cell] = footprint;
+        }
+        clickables = layout.clickables;
+        while (clickables) {
+            size_t cell = std::countr_zero(clickables);
+            clickables &= clickables - 1;
+            uint64_t before = layout.clickables & ((uint64_t(1) << cell) - 1);
+            while (before) {
+                size_t other = std::countr_zero(before);
+                before &= before - 1;
+                if (!(layout.footprints[cell] & layout.footprints[other])) {
+                    layout.commutesBefore[cell] |= uint64_t(1) << other;
+                }
+            }
+        }
+    }
+
+    static void computeEffects(Layout &layout) {
+        uint64_t clickables = layout.clickables;
+        while (clickables) {
+            size_t cell = std::countr_zero(clickables);
+            clickables &= clickables - 1;
+            uint64_t bit = uint64_t(1) << cell;
+            typename Layout::MoveEffect &effect = layout.effects[cell];
+            effect.color = colorMPHF(layout.colors[cell / cols][cell % cols]);
+            for (size_t direction = 0; direction < 4; direction++) {
+                for (uint64_t next = shift(bit, direction); next; next = shift(next, direction)) {
+                    effect.rays[direction] |= next;
+                }
+                if (layout.staticArrows[direction] & bit) {
+                    effect.staticDirection = direction;
+                }
+            }
+            uint64_t row = bit | shift(bit, LEFT) | shift(bit, RIGHT);
+            effect.area = (row | shift(row, UP) | shift(row, DOWN)) & layout.cells;
+            effect.neighbors = (shift(bit, UP) | shift(bit, RIGHT) | shift(bit, DOWN) | shift(bit, LEFT)) & layout.cells;
+        }
+    }
+
+    /**
+     * Parses the level into layout and returns its initial board, which points to layout.
+     * Both strings hold rows * cols cells, row by row.
+     */
+    static Board from(std::string_view color, std::string_view modifier, Layout &layout) {
+        layout = {};
+        Board initialBoard;
+        initialBoard.layout = &layout;
+        for (size_t row = 0; row < rows; row++) {
+            for (size_t col = 0; col < cols; col++) {
+                char c = color[row * cols + col];
+                char m = modifier[row * cols + col];
+                uint64_t bit = cellBit(row, col);
+                layout.colors[row][col] = c;
+                if (m == 'X') {
+                    continue;
+                }
+                layout.cells |= bit;
+                if (isColor(c)) {
+                    layout.targets[colorMPHF(c)] |= bit;
+                    layout.targetCells |= bit;
+                }
+                if (m == '0') {
+                    initialBoard.empty |= bit;
+                } else if (isColor(m)) {
+                    initialBoard.filled[colorMPHF(m)] |= bit;
+                } else if (m == 'U' || m == 'R' || m == 'D' || m == 'L') {
+                    layout.staticArrows[std::string_view(STATIC_ARROW_NAMES).find(m)] |= bit;
+                } else if (m == 'w' || m == 'x' || m == 's' || m == 'a') {
+                    layout.rotatingArrows |= bit;
+                    initialBoard.rotating[std::string_view(ROTATING_ARROW_NAMES).find(m)] |= bit;
+                } else if (m == 'F') {
+                    layout.floods |= bit;
+                } else if (m == 'B') {
+                    layout.bombs |= bit;
+                    layout.hasBombs = true;
                 } else {
                     std::cout << "Unknown modifier" << std::endl;
+                    continue;
+                }
+                if (!isColor(m) && m != '0') {
+                    layout.clickables |= bit;
                 }
             }
         }
+
+        computeFootprints(layout);
+        computeEffects(layout);
+
+        ReachabilityArray reachableFrom;
+        computeReachability(layout, reachableFrom);
         for (size_t row = 0; row < rows; row++) {
             for (size_t col = 0; col < cols; col++) {
                 if (reachableFrom[row][col].size() == 1) {
-                    initialBoard.fields[row][col].onlyReachableFrom = reachableFrom[row][col].front();
+                    layout.onlyReachableFrom[row][col] = reachableFrom[row][col].front();
+                } else {
+                    layout.onlyReachableFrom[row][col] = POSITION_NONE;
                 }
             }
         }
+        for (size_t row = 0; row < rows; row++) {
+            for (size_t col = 0; col < cols; col++) {
+                Position source = layout.onlyReachableFrom[row][col];
+                if (source == POSITION_NONE) {
+                    continue;
+                }
+                size_t index = 0;
+                while (index < layout.numSingleSources && layout.singleSources[index].position != source) {
+                    index++;
+                }
+                if (index == layout.numSingleSources) {
+                    layout.singleSources[layout.numSingleSources++].position = source;
+                }
+                Direction direction;
+                if (row == source.row) {
+                    direction = col < source.col ? LEFT : RIGHT;
+                } else {
+                    direction = row < source.row ? UP : DOWN;
+                }
+                layout.singleSources[index].cells |= cellBit(row, col);
+                layout.singleSources[index].byDirection[direction] |= cellBit(row, col);
+                layout.singleSourceOf[row * cols + col] = index;
+                layout.onlyReachable |= cellBit(row, col);
+            }
+        }
+        initialBoard.zobrist = initialBoard.computeHash();
         return initialBoard;
     }
 };
+
+/**
+ * Calls f.template operator()<rows, cols>() with the dimensions of a level with that many cells,
+ * so that everything after it works on boards of exactly that size. Small levels are 5 cells wide
+ * and 6 high. Every size listed here is compiled separately, see Geometry.
+ */
+template<typename F>
+auto withBoardSize(size_t cells, F f) {
+    if (cells == 5 * 6) {
+        return f.template operator()<6, 5>();
+    } else {
+        return f.template operator()<8, 6>();
+    }
+}
@@ -1,174 +1,911 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <unordered_set>
 #include <cassert>
 #include <unordered_map>
 #include <set>
 #include "Board.hpp"
-#include "SimpleApproximateMap.hpp"
+#include "Checkpoint.hpp"
+#include "LayeredSearch.hpp"
+#include "PatternDatabase.hpp"
+#include "SearchStats.hpp"
+#include "TranspositionTable.hpp"
+#include "WorkStealingPool.hpp"
 
-size_t minStepsNeeded(const Board &board) {
+/**
+ * Straightforward version of minStepsNeeded() that looks at every incorrect cell on its own.
+ * Only used to check the fast one when compiled with DEBUG_CHECKS.
+ */
+template<size_t rows, size_t cols>
+size_t minStepsNeededReference(const Board<rows, cols> &board) {
+    const BoardLayout<rows, cols> &layout = *board.layout;
     uint8_t positionsNeeded[rows][cols] = { 0 };
-    bool colorsNeeded[6] = {false};
-    bool colorsHandled[6] = {false};
-    bool colorsNeedRemoval[6] = {false};
+    bool colorsNeeded[numColors] = {false};
+    bool colorsHandled[numColors] = {false};
+    bool colorsNeedRemoval[numColors] = {false};
     size_t missing = 0;
     size_t needsRemoval = 0;
 
-    for (size_t row = 0; row < rows; row++) {
-        for (size_t col = 0; col < cols; col++) {
-            const Field &field = board.fields[row][col];
-            if (field.isCorrect()) {
-                continue;
-            }
-            if (field.getModifier() == '0') {
-                colorsNeeded[Field::colorMPHF(field.getColor())] = true;
+    uint64_t anyFilled = board.filledCells();
+    for (size_t color = 0; color < numColors; color++) {
+        uint64_t missingColor = layout.targets[color] & board.empty;
+        uint64_t wrongColor = layout.targets[color] & (anyFilled ^ board.filled[color]);
+        if (missingColor) {
+            colorsNeeded[color] = true;
+        }
+        for (size_t other = 0; other < numColors; other++) {
+            if ((wrongColor & board.filled[other]) && !colorsNeedRemoval[other]) {
+                // Needs to remove wrong color first
+                colorsNeedRemoval[other] = true;
+                needsRemoval++;
             }
-            if (field.onlyReachableFrom != POSITION_NONE) {
+        }
+
+        uint64_t incorrect = missingColor | wrongColor;
+        while (incorrect) {
+            size_t index = std::countr_zero(incorrect);
+            incorrect &= incorrect - 1;
+            size_t row = index / cols;
+            size_t col = index % cols;
+            Position onlyReachableFrom = layout.onlyReachableFrom[row][col];
+            if (onlyReachableFrom != POSITION_NONE) {
                 size_t clicksNeeded = 1;
-                size_t neededR = field.onlyReachableFrom.row;
-                size_t neededC = field.onlyReachableFrom.col;
-
-                if (board.fields[neededR][neededC].isRotatingArrow()) {
-                    char direction = board.fields[neededR][neededC].getModifier();
-                    if (row == neededR && col < neededC) { // left
-                        if (direction == 'w') clicksNeeded = 4;
-                        if (direction == 'x') clicksNeeded = 3;
-                        if (direction == 's') clicksNeeded = 2;
-                        if (direction == 'a') clicksNeeded = 1;
-                    } else if (row == neededR && col > neededC) { // right
-                        if (direction == 'w') clicksNeeded = 2;
-                        if (direction == 'x') clicksNeeded = 1;
-                        if (direction == 's') clicksNeeded = 4;
-                        if (direction == 'a') clicksNeeded = 3;
-                    } else if (col == neededC && row < neededR) { // above
-                        if (direction == 'w') clicksNeeded = 1;
-                        if (direction == 'x') clicksNeeded = 4;
-                        if (direction == 's') clicksNeeded = 3;
-                        if (direction == 'a') clicksNeeded = 2;
-                    } else if (col == neededC && row > neededR) { // below
-                        if (direction == 'w') clicksNeeded = 3;
-                        if (direction == 'x') clicksNeeded = 2;
-                        if (direction == 's') clicksNeeded = 1;
-                        if (direction == 'a') clicksNeeded = 4;
+                size_t neededR = onlyReachableFrom.row;
+                size_t neededC = onlyReachableFrom.col;
+
+                size_t direction = board.rotatingDirection(neededR, neededC);
+                if (direction < 4) {
+                    size_t neededDirection;
+                    if (row == neededR && col < neededC) {
+                        neededDirection = LEFT;
+                    } else if (row == neededR && col > neededC) {
+                        neededDirection = RIGHT;
+                    } else if (col == neededC && row < neededR) {
+                        neededDirection = UP;
+                    } else if (col == neededC && row > neededR) {
+                        neededDirection = DOWN;
                     } else {
                         std::cout<<"Unknown rotating arrow"<<std::endl;
                         exit(1);
                     }
+                    // Every click turns the arrow clockwise and the last one has to point to the field
+                    clicksNeeded = ((neededDirection - direction) & 3) + 1;
                 }
 
                 if (positionsNeeded[neededR][neededC] < clicksNeeded) {
                     missing += clicksNeeded - positionsNeeded[neededR][neededC];
                     positionsNeeded[neededR][neededC] = clicksNeeded;
                 }
-                colorsHandled[Field::colorMPHF(field.getColor())] = true;
-            }
-            if (Field::isColor(field.getModifier())) {
-                // Needs to remove wrong color first
-                if (!colorsNeedRemoval[Field::colorMPHF(field.getModifier())]) {
-                    colorsNeedRemoval[Field::colorMPHF(field.getModifier())] = true;
-                    needsRemoval++;
-                }
+                colorsHandled[color] = true;
             }
         }
     }
-    for (size_t i = 0; i < 5; i++) { // Colors only give hash values from 0..5
+    for (size_t i = 0; i < numColors; i++) {
         if (colorsNeeded[i] && !colorsHandled[i]) {
             missing++;
         }
     }
-    if (!board.hasBombs) {
+    if (!layout.hasBombs) {
         missing += needsRemoval;
     }
     return missing;
 }
 
-void branch(size_t levelNr, Board board, size_t &bound, Board &best, SimpleApproximateMap<uint64_t, size_t> &minimalMoves) {
-    if (board.moveSequence.n >= bound) {
-        return; // Give up
+/**
+ * Admissible estimate for the number of clicks still needed: every needed click of a clickable
+ * that is the only way to fill some incorrect cell, one click for every other color that is
+ * still missing, and one for every color that has to be removed (unless bombs can do that).
+ * Works on whole masks, the cells that only one clickable reaches are grouped in the layout.
+ */
+template<size_t rows, size_t cols>
+size_t minStepsNeeded(const Board<rows, cols> &board) {
+    const BoardLayout<rows, cols> &layout = *board.layout;
+    size_t missing = 0;
+    uint64_t incorrect = board.incorrectCells();
+    for (size_t color = 0; color < numColors; color++) {
+        uint64_t missingColor = layout.targets[color] & board.empty;
+        if (missingColor && !(layout.targets[color] & incorrect & layout.onlyReachable)) {
+            missing++; // Nothing tells which clickable fills it, but one has to
+        }
+    }
+
+    uint64_t pending = incorrect & layout.onlyReachable;
+    while (pending) {
+        const auto &source = layout.singleSources[layout.singleSourceOf[std::countr_zero(pending)]];
+        pending &= ~source.cells;
+        size_t clicksNeeded = 1;
+        size_t direction = board.rotatingDirection(source.position.row, source.position.col);
+        if (direction < 4) {
+            // Every click turns the arrow clockwise and the last one has to point to the field
+            for (size_t neededDirection = 0; neededDirection < 4; neededDirection++) {
+                if (incorrect & source.byDirection[neededDirection]) {
+                    clicksNeeded = std::max<size_t>(clicksNeeded, ((neededDirection - direction) & 3) + 1);
+                }
+            }
+        }
+        missing += clicksNeeded;
+    }
+    if (!layout.hasBombs) {
+        missing += std::popcount(board.colorsNeedingRemoval());
+    }
+#ifdef DEBUG_CHECKS
+    if (missing != minStepsNeededReference(board)) {
+        std::cout<<"minStepsNeeded differs from the reference for"<<std::endl;
+        board.print();
+        exit(1);
+    }
+#endif
+    return missing;
+}
+
+enum class BoundPolicy {
+    STEPS, // Fixed list of bound steps
+    IDA // Next bound is the smallest f-value that exceeded the previous one
+};
+
+/**
+ * When solveBranchAndBound() has to stop and return the best solution it has so far.
+ * Workers report their nodes in batches, so limits are only checked every few thousand nodes.
+ */
+struct SearchLimits {
+    static constexpr uint64_t batch = 4096;
+
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    uint64_t nodeLimit = UINT64_MAX;
+    SearchLimits *run = nullptr; // Limits of all levels together
+    std::atomic<uint64_t> nodes = 0;
+    std::atomic<bool> reached = false;
+
+    /**
+     * A limit of 0 means no limit.
+     */
+    explicit SearchLimits(double seconds = 0, uint64_t maxNodes = 0, SearchLimits *run = nullptr) : run(run) {
+        if (seconds > 0) {
+            deadline = std::chrono::steady_clock::now()
+                    + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+        }
+        if (maxNodes > 0) {
+            nodeLimit = maxNodes;
+        }
+    }
+
+    /**
+     * Adds newNodes and returns whether any limit, here or of the run, is reached.
+     */
+    bool check(uint64_t newNodes) {
+        uint64_t total = nodes.fetch_add(newNodes, std::memory_order_relaxed) + newNodes;
+        bool runReached = run != nullptr && run->check(newNodes);
+        if (runReached || total >= nodeLimit || std::chrono::steady_clock::now() >= deadline) {
+            reached.store(true, std::memory_order_relaxed);
+        }
+        return reached.load(std::memory_order_relaxed);
+    }
+};
+
+struct SolverOptions {
+    size_t threads = 1;
+    BoundPolicy boundPolicy = BoundPolicy::IDA;
+    size_t boundIncrement = 1; // IDA* raises the bound by at least this much
+    bool patternDatabase = true; // Also prune with the bounds of PatternDatabase
+    bool movePruning = true; // Explore clicks that commute in one order only
+    bool moveOrdering = false; // Sort children close to the root, see MoveOrdering
+    size_t beamWidth = 256; // Widest beamSearch() for an initial upper bound, 0 to skip it
+    bool bfs = false; // Use solveBFS instead, see BfsSolver.hpp
+    std::string bfsDirectory; // Use solveExternalBFS with this directory instead, see ExternalBfsSolver.hpp
+    size_t bfsMemoryMegabytes = 1024;
+    double timeLimit = 0; // Seconds per level, 0 for none
+    uint64_t nodeLimit = 0; // Branch and bound nodes per level, 0 for none
+    SearchLimits *runLimits = nullptr; // Shared by all levels of the run
+    std::string checkpointDirectory; // Save the progress of every level there, see Checkpoint
+    double checkpointInterval = 300; // Seconds between checkpoints while a level is searched
+    bool checkpointTable = false; // Also save the transposition table with every checkpoint
+    bool resume = false; // Continue from the checkpoints in checkpointDirectory
+    size_t lowerBound = 0; // Proven before, for example by an earlier run, see SolutionCache
+};
+
+/**
+ * Search state shared by all threads working on one bound step.
+ *
+ * The bound packs the length of the best solution together with the index of the task that
+ * found it. Nodes are compared as (moves, task), so a task can still replace the best solution
+ * with an equally long one if it comes earlier in task order. Together with the task stored in
+ * the transposition table, this makes the result independent of thread timing.
+ */
+template<size_t rows, size_t cols>
+struct BranchBoundSearch {
+    size_t levelNr;
+    TranspositionTable &minimalMoves;
+    std::ostream &log;
+    SearchLimits &limits;
+    std::atomic<uint64_t> bound;
+    std::mutex bestMutex;
+    Board<rows, cols> best = {};
+    std::atomic<size_t> nextBound = SIZE_MAX; // Smallest f-value that exceeded the bound
+    size_t provenLowerBound = 0; // Earlier iterations showed that no shorter solution exists
+    const PatternDatabase<rows, cols> *patterns = nullptr;
+    bool movePruning = true;
+    bool moveOrdering = false;
+    SearchStats stats; // Added up from the workers under bestMutex
+    std::vector<bool> done; // Tasks that were searched completely, under bestMutex
+    std::function<void()> onTaskDone; // Called under bestMutex once a task is done, for checkpoints
+
+    static uint64_t packBound(size_t moves, size_t task) {
+        return (uint64_t(moves) << 32) | task;
     }
+};
+
+/**
+ * What the search of one task learned about good clicks. Kept across the bound steps of a level,
+ * and per task, so that the order of the search does not depend on other threads.
+ */
+struct MoveOrdering {
+    static constexpr uint8_t NONE = UINT8_MAX;
+    static constexpr size_t minHeight = 6; // Children are only sorted if the bound is further away
+
+    uint32_t history[maxCells] = {}; // How often the click led to the best child, weighted by height
+    uint8_t killers[maxSteps + 1]; // Cell of the last best child, by depth
+
+    MoveOrdering() {
+        std::fill(std::begin(killers), std::end(killers), NONE);
+    }
+};
+
+/**
+ * State of one thread while it works on one task.
+ */
+template<size_t rows, size_t cols>
+struct BranchBoundWorker {
+    size_t task;
+    Board<rows, cols> board;
+    MoveSequence path; // Single move stack, the board itself is changed in place
+    MoveOrdering &ordering;
+    size_t nextBound = SIZE_MAX;
+    size_t childStepsNeeded = SIZE_MAX; // minStepsNeeded() of the next board, if the parent knows it
+    SearchStats stats;
+};
+
+/**
+ * Calls visit(row, col) for every clickable cell that is not skipped, in the order branch() explores them.
+ */
+template<size_t rows, size_t cols, typename F>
+void forEachMove(const Board<rows, cols> &board, uint64_t hash, uint64_t skip, F visit) {
+    uint64_t clickable = board.clickableCells() & ~skip;
+    size_t rowOffset = hash % rows;
+    size_t colOffset = (hash >> 10) % cols;
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t col = 0; col < cols; col++) {
+            size_t permutedRow = (row + rowOffset) % rows;
+            size_t permutedCol = (col + colOffset) % cols;
+            if (!(clickable & Geometry<rows, cols>::cellBit(permutedRow, permutedCol))) {
+                continue;
+            }
+            visit(permutedRow, permutedCol);
+        }
+    }
+}
+
+/**
+ * Searches the subtree of the worker's board in place: children are created by make() and
+ * taken back by unmake(). Returns a lower bound for the length of any solution through the
+ * current state, which ends up in the transposition table for the following iterations.
+ */
+template<size_t rows, size_t cols>
+size_t branch(BranchBoundSearch<rows, cols> &search, BranchBoundWorker<rows, cols> &worker) {
+    using Search = BranchBoundSearch<rows, cols>;
+    Board<rows, cols> &board = worker.board;
+    MoveSequence &path = worker.path;
+    size_t task = worker.task;
+    size_t moves = path.n;
+    SearchStats &stats = worker.stats;
+    size_t estimate = worker.childStepsNeeded;
+    worker.childStepsNeeded = SIZE_MAX;
+    stats.nodes++;
+    if (stats.nodes % SearchLimits::batch == 0) {
+        search.limits.check(SearchLimits::batch);
+    }
+    if (search.limits.reached.load(std::memory_order_relaxed)) {
+        return moves; // Unwind, nothing of an interrupted iteration is used except its best solution
+    }
+    // No solution is shorter than provenLowerBound, so once the best one has that length,
+    // only tasks that would win a tie still need to search
+    size_t minSolution = std::max(moves, search.provenLowerBound);
+    if (Search::packBound(minSolution, task) >= search.bound.load(std::memory_order_relaxed)) {
+        worker.nextBound = std::min(worker.nextBound, minSolution);
+        stats.prunedByBound++;
+        return minSolution; // Give up
+    }
+    // Clicking a cell that commutes with the last click and comes before it gives a board
+    // that the other order reaches as well, so such clicks are skipped. The lower bound of an
+    // expansion without them only holds for expansions that skip at least the same clicks,
+    // so entries remember the last click they were expanded after.
+    uint64_t clickable = board.clickableCells();
+    auto skippedAfter = [&](uint8_t lastClick) {
+        return lastClick == TranspositionTable::Entry::ALL_CLICKS ? 0 : board.layout->commutesBefore[lastClick] & clickable;
+    };
     uint64_t hash = board.hash();
-    auto existing = minimalMoves.get(hash);
-    if (existing.value == nullptr) {
-        minimalMoves.insert(hash, board.moveSequence.n);
+    TranspositionTable::Entry existing;
+    TranspositionTable::Entry current = {uint8_t(moves), uint32_t(task)};
+    if (search.movePruning && path.n > 0) {
+        Position last = path.moves[path.n - 1];
+        current.lastClick = last.row * cols + last.col;
+    }
+    uint64_t skipped = skippedAfter(current.lastClick);
+    uint64_t commuting = skipped; // Clicks that are not searched from here
+    uint64_t skippedByOthers = 0;
+    size_t othersSolution = SIZE_MAX; // Lower bound of the clicks that someone else searches
+    if (!search.minimalMoves.probe(hash, existing)) {
+        stats.transpositionMisses++;
+        stats.transpositionOverwrites += search.minimalMoves.store(hash, current);
     } else {
-        if (*existing.value == board.moveSequence.n) {
+        stats.transpositionHits++;
+        uint64_t skippedByExisting = skippedAfter(existing.lastClick);
+        bool covered = (skippedByExisting & ~commuting) == 0;
+        if (covered) {
+            current.lowerBound = existing.lowerBound;
+        }
+        if (existing.moves == moves) {
             // Someone else already reached this state with the same number of moves
-            if (existing.isSameEpoch) {
-                // Someone else already recursed from here
-                return;
+            if (existing.epoch == search.minimalMoves.currentEpoch() && existing.task <= task) {
+                // Someone else already recursed from here, and would win a tie against us.
+                // Only the clicks that they skip and we do not are left to us.
+                stats.prunedByTransposition++;
+                if (covered) {
+                    return moves + existing.lowerBound;
+                }
+                commuting |= clickable & ~skippedByExisting;
+                skippedByOthers = skippedByExisting;
+                othersSolution = moves + existing.lowerBound;
             } else {
                 // Still need to recurse from here
-                minimalMoves.insert(hash, board.moveSequence.n); // Update epoch
+                search.minimalMoves.store(hash, current); // Update epoch
             }
-        } else if (*existing.value < board.moveSequence.n) {
+        } else if (existing.moves < moves) {
             // Someone else already reached this state with fewer moves
-            return; // Give up
+            stats.prunedByTransposition++;
+            return moves + current.lowerBound; // Give up
         } else {
-            *existing.value = board.moveSequence.n;
+            search.minimalMoves.store(hash, current);
         }
     }
 
-    size_t stepsNeeded = minStepsNeeded(board);
-    if (board.moveSequence.n + stepsNeeded >= bound) {
-        static size_t previousPrint = 0;
-        previousPrint++;
-        if (previousPrint >= 1000000) {
-            std::cout<<"# Progress: "<<board.moveSequence.toString()<<std::endl;
-            previousPrint = 0;
+    if (estimate == SIZE_MAX) {
+        estimate = minStepsNeeded(board);
+    }
+    size_t stepsNeeded = std::max<size_t>(estimate, current.lowerBound);
+    stepsNeeded = std::max(stepsNeeded, minSolution - moves);
+    uint64_t bound = search.bound.load(std::memory_order_relaxed);
+    if (search.patterns != nullptr && Search::packBound(moves + stepsNeeded, task) < bound) {
+        // Only worth looking up if the cheap estimate does not cut off anyway
+        stepsNeeded = std::max(stepsNeeded, search.patterns->lowerBound(board));
+    }
+    if (Search::packBound(moves + stepsNeeded, task) >= bound) {
+        stats.prunedByHeuristic++;
+        if (stats.prunedByHeuristic % 1000000 == 0) {
+            std::lock_guard<std::mutex> lock(search.bestMutex); // The log is shared by all threads
+            search.log<<"# Progress: "<<path.toString()<<'\n';
         }
-        return;
+        worker.nextBound = std::min(worker.nextBound, moves + stepsNeeded);
+        return moves + stepsNeeded;
     }
 
     if (board.isSolved()) {
-        if (board.moveSequence.n < bound) {
-            bound = board.moveSequence.n;
-            std::cout<<"# New bound for "<<levelNr<<": "
-                     <<bound<<" using "<<board.moveSequence.toString()<<std::endl;
-            best = board;
+        std::lock_guard<std::mutex> lock(search.bestMutex);
+        uint64_t packed = Search::packBound(moves, task);
+        if (packed < search.bound.load(std::memory_order_relaxed)) {
+            search.bound.store(packed, std::memory_order_relaxed);
+            search.log<<"# New bound for "<<search.levelNr<<": "
+                     <<moves<<" using "<<path.toString()<<std::endl;
+            search.best = board;
+            search.best.moveSequence = path;
         }
-        return;
+        return moves;
+    }
+    if (moves == maxSteps) {
+        return moves + 1; // No room for more moves
     }
 
-    size_t rowOffset = hash % rows;
-    size_t colOffset = (hash >> 10) % cols;
-    for (size_t row = 0; row < rows; row++) {
-        for (size_t col = 0; col < cols; col++) {
-            size_t permutedRow = (row + rowOffset) % rows;
-            size_t permutedCol = (col + colOffset) % cols;
-            if (!board.fields[permutedRow][permutedCol].isClickable()) {
+    // Close to the root, where subtrees are large, children that look closest to a solution
+    // come first, ties go to the killer and then by history. Further down, sorting costs more
+    // than it saves, so the children keep their order. Every child is a single sort key:
+    // estimate, not killer, inverted history and then the cell in the lowest 8 bits.
+    uint64_t children[rows * cols];
+    size_t numChildren = 0;
+    MoveOrdering &ordering = worker.ordering;
+    size_t boundMoves = search.bound.load(std::memory_order_relaxed) >> 32;
+    bool sorted = search.moveOrdering && boundMoves > moves + MoveOrdering::minHeight;
+    forEachMove(board, hash, commuting, [&](size_t row, size_t col) {
+        size_t cell = row * cols + col;
+        if (!sorted) {
+            children[numChildren++] = cell;
+            return;
+        }
+        Undo undo;
+        bool changed = board.make(row, col, undo);
+        uint64_t stepsNeeded = changed ? minStepsNeeded(board) : 0;
+        board.unmake(undo);
+        if (!changed) {
+            stats.noOpClicks++;
+        } else {
+            uint64_t notKiller = ordering.killers[moves] != cell;
+            uint64_t history = std::min<uint32_t>(ordering.history[cell], UINT32_MAX >> 1);
+            children[numChildren++] = (stepsNeeded << 48) | (notKiller << 47) | ((~history & (UINT32_MAX >> 1)) << 16) | cell;
+        }
+    });
+    for (size_t i = 1; sorted && i < numChildren; i++) { // Insertion sort, there are only a few children
+        uint64_t child = children[i];
+        size_t j = i;
+        for (; j > 0 && child < children[j - 1]; j--) {
+            children[j] = children[j - 1];
+        }
+        children[j] = child;
+    }
+
+    minSolution = SIZE_MAX;
+    size_t bestChild = 0;
+    stats.expandedByDepth[moves]++;
+    for (size_t i = 0; i < numChildren; i++) {
+        size_t cell = children[i] & 0xff;
+        Undo undo;
+        if (!board.make(cell / cols, cell % cols, undo)) {
+            stats.noOpClicks++;
+        } else {
+            stats.childrenByDepth[moves]++;
+            path.moves[path.n++] = Position(cell / cols, cell % cols);
+            worker.childStepsNeeded = sorted ? children[i] >> 48 : SIZE_MAX;
+            size_t solution = branch(search, worker);
+            path.n--;
+            if (solution < minSolution) {
+                minSolution = solution;
+                bestChild = cell;
+            }
+        }
+        board.unmake(undo);
+    }
+    if (minSolution != SIZE_MAX) {
+        ordering.killers[moves] = bestChild;
+        ordering.history[bestChild] += maxSteps - moves;
+    }
+
+    if (othersSolution != SIZE_MAX) {
+        // Together, the two expansions only skipped the clicks that both of them skip
+        minSolution = std::min(minSolution, othersSolution);
+        if (!(skipped & skippedByOthers)) {
+            current.lastClick = TranspositionTable::Entry::ALL_CLICKS;
+        } else if ((skipped & skippedByOthers) != skipped) {
+            return minSolution; // No entry can say that, so theirs stays
+        }
+    }
+    // Every solution through this state that does not start with a skipped click needs
+    // at least minSolution moves in total
+    current.lowerBound = std::min<size_t>(minSolution - moves, UINT8_MAX);
+    stats.transpositionOverwrites += search.minimalMoves.store(hash, current);
+    return minSolution;
+}
+
+template<size_t rows, size_t cols>
+void branch(BranchBoundSearch<rows, cols> &search, size_t task, const Board<rows, cols> &start, MoveOrdering &ordering) {
+    BranchBoundWorker<rows, cols> worker = {task, start, start.moveSequence, ordering};
+    branch(search, worker);
+    search.limits.check(worker.stats.nodes % SearchLimits::batch); // Tasks are often smaller than a batch
+    size_t nextBound = search.nextBound.load(std::memory_order_relaxed);
+    while (worker.nextBound < nextBound
+           && !search.nextBound.compare_exchange_weak(nextBound, worker.nextBound, std::memory_order_relaxed)) {
+    }
+    std::lock_guard<std::mutex> lock(search.bestMutex);
+    search.stats.add(worker.stats);
+    if (task < search.done.size() && !search.limits.reached.load(std::memory_order_relaxed)) {
+        search.done[task] = true;
+        if (search.onTaskDone) {
+            search.onTaskDone();
+        }
+    }
+}
+
+/**
+ * Expands the top of the search tree breadth-first until there are enough independent subtrees
+ * to keep the threads busy. The split does not depend on the number of threads, so neither
+ * does the solution that is picked among equally long ones. stats counts the expanded boards,
+ * which branch() never sees.
+ */
+template<size_t rows, size_t cols>
+std::vector<Board<rows, cols>> splitSearchTree(const Board<rows, cols> &initialBoard, SearchStats &stats) {
+    constexpr size_t minTasks = 256;
+    constexpr size_t maxSplitDepth = 4;
+    std::vector<Board<rows, cols>> tasks = {initialBoard};
+    for (size_t depth = 0; depth < maxSplitDepth && tasks.size() < minTasks; depth++) {
+        std::vector<Board<rows, cols>> next;
+        std::unordered_set<uint64_t> seen;
+        for (const Board<rows, cols> &board : tasks) {
+            uint64_t hash = board.hash();
+            if (board.isSolved()) {
+                next.push_back(board); // Leaves stay tasks of their own
                 continue;
             }
-            Board newBoard = board;
-            bool somethingChanged = newBoard.click(permutedRow, permutedCol);
-            if (somethingChanged) {
-                branch(levelNr, newBoard, bound, best, minimalMoves);
+            stats.nodes++;
+            stats.expandedByDepth[depth]++;
+            forEachMove(board, hash, 0, [&](size_t row, size_t col) {
+                Board<rows, cols> child = board;
+                if (child.click(row, col) && seen.insert(child.hash()).second) {
+                    next.push_back(child);
+                    stats.childrenByDepth[depth]++;
+                }
+            });
+        }
+        tasks = std::move(next);
+    }
+    return tasks;
+}
+
+/**
+ * Beam search for some solution, not necessarily the shortest one. Every layer keeps the width
+ * children with the smallest lower bound (ties in the order they were generated), and skips boards
+ * that an earlier layer already had. States are kept packed, and a ParentChain rebuilds the solution.
+ * Returns an unsolved board if the beam runs dry.
+ */
+template<size_t rows, size_t cols>
+Board<rows, cols> beamSearch(const Board<rows, cols> &initialBoard, size_t width,
+                             const PatternDatabase<rows, cols> *patterns) {
+    struct Candidate {
+        size_t stepsNeeded;
+        typename Board<rows, cols>::Packed state;
+        uint32_t parent;
+        uint8_t move;
+    };
+    if (initialBoard.isSolved()) {
+        return initialBoard;
+    }
+    ParentChain chain;
+    std::vector<typename Board<rows, cols>::Packed> layer = {initialBoard.pack()};
+    size_t layerStart = 0; // Index of layer[0] in chain
+    HashSet seen;
+    seen.insert(initialBoard.hash());
+    Board<rows, cols> board = initialBoard;
+    std::vector<Candidate> children;
+    for (size_t steps = 1; steps <= maxSteps && !layer.empty(); steps++) {
+        children.clear();
+        for (size_t i = 0; i < layer.size(); i++) {
+            board.unpack(layer[i]);
+            Board<rows, cols> solved;
+            bool found = forEachChild(board, [&](size_t cell) {
+                if (!seen.insert(board.hash())) {
+                    return false;
+                } else if (board.isSolved()) {
+                    solved = chain.solution(initialBoard, layerStart + i, cell);
+                    return true;
+                }
+                size_t stepsNeeded = minStepsNeeded(board);
+                if (patterns != nullptr) {
+                    stepsNeeded = std::max(stepsNeeded, patterns->lowerBound(board));
+                }
+                if (steps + stepsNeeded <= maxSteps) {
+                    children.push_back({stepsNeeded, board.pack(), uint32_t(layerStart + i), uint8_t(cell)});
+                }
+                return false;
+            });
+            if (found) {
+                return solved;
             }
         }
+        size_t kept = std::min(width, children.size());
+        std::stable_sort(children.begin(), children.end(), [](const Candidate &a, const Candidate &b) {
+            return a.stepsNeeded < b.stepsNeeded;
+        });
+        layerStart = chain.size();
+        layer.clear();
+        for (size_t i = 0; i < kept; i++) {
+            layer.push_back(children[i].state);
+            chain.push(children[i].parent, children[i].move);
+        }
+    }
+    return {};
+}
+
+/**
+ * Board after the given moves, as written by MoveSequence::toString(). Moves from a file have to
+ * pass solves() first.
+ */
+template<size_t rows, size_t cols>
+Board<rows, cols> replay(Board<rows, cols> board, const std::string &moves) {
+    size_t pos = 0;
+    while (pos < moves.length()) {
+        board.click(moves.c_str() + pos);
+        size_t comma = moves.find(',', pos);
+        if (comma == std::string::npos) {
+            break;
+        }
+        pos = comma + 1;
+    }
+    return board;
+}
+
+/**
+ * Whether moves, like MoveSequence::toString(), are clicks on the board that solve it. Checks them
+ * before replaying, so that moves from a file cannot click outside of the board.
+ */
+template<size_t rows, size_t cols>
+bool solves(const Board<rows, cols> &board, const std::string &moves) {
+    size_t n = (moves.length() + 1) / 3;
+    if (n > maxSteps || (!moves.empty() && moves.length() != 3 * n - 1)) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        char col = moves[3 * i];
+        char row = moves[3 * i + 1];
+        if (col < 'A' || col >= char('A' + cols) || row < '1' || row >= char('1' + rows)
+                || (i + 1 < n && moves[3 * i + 2] != ',')) {
+            return false;
+        }
     }
+    return replay(board, moves).isSolved();
 }
 
-Board solveBranchAndBound(size_t levelNr, Board initialBoard) {
-    static SimpleApproximateMap<uint64_t, size_t> minimalMoves;
+/**
+ * Returns the shortest solution, or with a time or node limit, the best one found until the limit.
+ * stats receives whether it is optimal and the lower bound that the completed iterations proved.
+ *
+ * With a checkpoint directory, the progress is saved there every checkpointInterval seconds
+ * and when the level is done or runs into a limit, see Checkpoint. Checkpoints are taken
+ * between tasks, whenever one is done.
+ */
+template<size_t rows, size_t cols>
+Board<rows, cols> solveBranchAndBound(size_t levelNr, Board<rows, cols> initialBoard, TranspositionTable &minimalMoves,
+                                      const SolverOptions &options = {}, std::ostream &log = std::cout,
+                                      SolveStats *stats = nullptr) {
+    using Search = BranchBoundSearch<rows, cols>;
     minimalMoves.clear();
 
+    SearchLimits limits(options.timeLimit, options.nodeLimit, options.runLimits);
+
     size_t boundSteps[] = {10, 15, 20, 25, 30, 35, 40};
     //size_t boundSteps[] = {15, 33};
+    size_t step = 0;
+
+    std::filesystem::path checkpointPath;
+    std::filesystem::path tablePath;
+    Checkpoint resumed;
+    bool resuming = false;
+    if (!options.checkpointDirectory.empty()) {
+        checkpointPath = std::filesystem::path(options.checkpointDirectory) / ("level-" + std::to_string(levelNr) + ".checkpoint");
+        tablePath = checkpointPath;
+        tablePath += ".tt";
+        resuming = options.resume && resumed.read(checkpointPath);
+        if (resuming && resumed.board != initialBoard.encode()) {
+            log<<"# Checkpoint of "<<levelNr<<" is for a different board, starting over"<<std::endl;
+            resumed = {};
+            resuming = false;
+        } else if (resuming && (resumed.iterativeBound > maxSteps || resumed.step >= std::size(boundSteps)
+                                || ((resumed.status == SolveStatus::OPTIMAL || !resumed.solution.empty())
+                                    && !solves(initialBoard, resumed.solution)))) {
+            log<<"# Checkpoint of "<<levelNr<<" is broken, starting over"<<std::endl;
+            resumed = {};
+            resuming = false;
+        }
+    }
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+
+    // Even a single thread searches the same tasks in the same order, so that ties between
+    // equally long solutions are broken the same way, and a checkpoint can be taken between tasks
+    auto splitStart = std::chrono::steady_clock::now();
+    SearchStats splitStats;
+    std::vector<Board<rows, cols>> tasks = splitSearchTree(initialBoard, splitStats);
+    if (stats != nullptr) {
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - splitStart;
+        stats->search.add(splitStats);
+        stats->searchSeconds += seconds.count();
+    }
+
+    std::unique_ptr<PatternDatabase<rows, cols>> patterns;
+    size_t lowerBound = minStepsNeeded(initialBoard);
+    if (options.patternDatabase && !(resuming && resumed.finished())) {
+        patterns = std::make_unique<PatternDatabase<rows, cols>>(*initialBoard.layout);
+        lowerBound = std::max(lowerBound, patterns->lowerBound(initialBoard));
+    }
+    lowerBound = std::max(lowerBound, options.lowerBound);
+    size_t iterativeBound = options.boundPolicy == BoundPolicy::IDA ? lowerBound : boundSteps[0];
+    size_t provenLowerBound = options.lowerBound;
 
-    for (size_t iterativeBound : boundSteps) {
+    // search is the running iteration, or nullptr between iterations
+    auto saveCheckpoint = [&](const Search *search) {
+        Checkpoint checkpoint;
+        checkpoint.board = initialBoard.encode();
+        checkpoint.lowerBound = lowerBound;
+        checkpoint.iterativeBound = iterativeBound;
+        checkpoint.provenLowerBound = provenLowerBound;
+        checkpoint.step = step;
+        if (search != nullptr) {
+            if (search->best.isSolved()) {
+                checkpoint.solution = search->best.moveSequence.toString();
+                checkpoint.solutionTask = search->bound.load(std::memory_order_relaxed) & UINT32_MAX;
+            }
+            checkpoint.nextBound = search->nextBound.load(std::memory_order_relaxed);
+            checkpoint.done = search->done;
+        }
+        if (options.checkpointTable) {
+            minimalMoves.save(tablePath);
+            checkpoint.table = true;
+        }
+        checkpoint.write(checkpointPath);
+        lastCheckpoint = std::chrono::steady_clock::now();
+    };
+    auto checkpointDue = [&]() {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - lastCheckpoint;
+        return !checkpointPath.empty() && elapsed.count() >= options.checkpointInterval;
+    };
+    // A quick solution of the beam search caps every bound step: the exact search then only
+    // has to show that nothing shorter exists
+    Board<rows, cols> upperBoundSolution = {};
+    size_t upperBound = maxSteps + 1;
+    auto finish = [&](const Board<rows, cols> &result, SolveStatus status) {
+        if (status == SolveStatus::OPTIMAL) {
+            lowerBound = result.moveSequence.n;
+        } else if (status == SolveStatus::UNSOLVABLE) {
+            lowerBound = maxSteps + 1;
+        }
+        if (stats != nullptr) {
+            stats->status = status;
+            stats->lowerBound = lowerBound;
+        }
+        if (!checkpointPath.empty() && (status == SolveStatus::OPTIMAL || status == SolveStatus::UNSOLVABLE)) {
+            Checkpoint checkpoint;
+            checkpoint.board = initialBoard.encode();
+            checkpoint.status = status;
+            checkpoint.lowerBound = lowerBound;
+            checkpoint.solution = result.moveSequence.toString();
+            checkpoint.write(checkpointPath);
+            std::filesystem::remove(tablePath);
+        }
+        return result;
+    };
+    // Nothing shorter than the beam search solution exists, if there is one at all
+    auto finishExhausted = [&]() {
+        if (upperBoundSolution.isSolved()) {
+            return finish(upperBoundSolution, SolveStatus::OPTIMAL);
+        }
+        return finish({}, SolveStatus::UNSOLVABLE);
+    };
+
+    if (resuming && resumed.finished()) {
+        log<<"# Level "<<levelNr<<" was already "<<toString(resumed.status)<<" in the checkpoint"<<std::endl;
+        Board<rows, cols> solution = resumed.status == SolveStatus::OPTIMAL ? replay(initialBoard, resumed.solution)
+                                                                            : Board<rows, cols>();
+        if (stats != nullptr) {
+            stats->status = resumed.status;
+            stats->lowerBound = resumed.lowerBound;
+        }
+        return solution;
+    }
+
+    for (size_t width = 16; width <= options.beamWidth; width *= 2) { // Anytime: wider beams until it is optimal
+        Board<rows, cols> solution = beamSearch(initialBoard, width, patterns.get());
+        if (solution.isSolved() && solution.moveSequence.n < upperBound) {
+            upperBoundSolution = solution;
+            upperBound = solution.moveSequence.n;
+            if (stats != nullptr) {
+                stats->beamSolution = upperBound;
+            }
+            log<<"# Beam search found "<<upperBound<<" steps for "<<levelNr<<std::endl;
+            if (upperBound <= lowerBound) {
+                return finish(upperBoundSolution, SolveStatus::OPTIMAL);
+            }
+        }
+    }
+
+    if (resuming) {
+        log<<"# Resuming "<<levelNr<<" at "<<resumed.iterativeBound<<" steps"<<std::endl;
+        iterativeBound = resumed.iterativeBound;
+        provenLowerBound = resumed.provenLowerBound;
+        step = resumed.step;
+        lowerBound = std::max({lowerBound, provenLowerBound, resumed.lowerBound});
+        if (resumed.table && !minimalMoves.load(tablePath)) {
+            log<<"# Transposition table of the checkpoint does not fit, starting with an empty one"<<std::endl;
+        }
+        if (resumed.done.size() != tasks.size()) {
+            resumed.done.assign(tasks.size(), false);
+        }
+    }
+
+    std::vector<MoveOrdering> orderings(tasks.size());
+    while (true) {
+        iterativeBound = std::min(iterativeBound, upperBound - 1);
         if (iterativeBound > maxSteps) {
             std::cout<<"Broken step sequence"<<std::endl;
             exit(1);
         }
-        std::cout<<"# Testing "<<iterativeBound<<" steps"<<std::endl;
-        size_t bound = iterativeBound + 1;
+        if (limits.check(0)) { // Nothing left for this level, for example because the run is out of time
+            if (!checkpointPath.empty()) {
+                saveCheckpoint(nullptr);
+            }
+            return finish(upperBoundSolution, upperBoundSolution.isSolved() ? SolveStatus::BOUNDED : SolveStatus::UNKNOWN);
+        }
+        if (checkpointDue()) {
+            saveCheckpoint(nullptr);
+        }
+        log<<"# Testing "<<iterativeBound<<" steps"<<std::endl;
+        Search search = {levelNr, minimalMoves, log, limits};
+        search.bound = Search::packBound(iterativeBound + 1, 0);
+        search.provenLowerBound = provenLowerBound;
+        search.patterns = patterns.get();
+        search.movePruning = options.movePruning;
+        search.moveOrdering = options.moveOrdering;
+        search.done.assign(tasks.size(), false);
+        if (resuming) { // Only the tasks that were not done yet
+            if (!resumed.solution.empty()) {
+                search.best = replay(initialBoard, resumed.solution);
+                search.bound = Search::packBound(search.best.moveSequence.n, resumed.solutionTask);
+            }
+            search.nextBound = resumed.nextBound;
+            search.done = resumed.done;
+            resuming = false;
+        }
+        if (!checkpointPath.empty()) {
+            search.onTaskDone = [&]() {
+                if (checkpointDue()) {
+                    saveCheckpoint(&search);
+                }
+            };
+        }
         minimalMoves.nextEpoch();
-        Board best = {};
-        branch(levelNr, initialBoard, bound, best, minimalMoves);
-        if (best.isSolved()) {
-            return best;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<size_t> pending;
+        for (size_t task = 0; task < tasks.size(); task++) {
+            if (!search.done[task]) {
+                pending.push_back(task);
+            }
         }
+        WorkStealingPool pool(options.threads);
+        pool.run(pending.size(), [&](size_t index, size_t) {
+            size_t task = pending[index];
+            branch(search, task, tasks[task], orderings[task]);
+        });
+        if (stats != nullptr) {
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            stats->search.add(search.stats);
+            stats->searchSeconds += seconds.count();
+            stats->iterations.push_back({iterativeBound, seconds.count(), search.stats.nodes});
+        }
+        if (limits.reached) {
+            // Whatever this iteration found is shorter than the beam search solution, but other
+            // tasks might not have gotten to an even shorter one
+            log<<"# Search limit reached for "<<levelNr<<", lower bound "<<lowerBound<<std::endl;
+            if (!checkpointPath.empty()) {
+                saveCheckpoint(&search);
+            }
+            if (search.best.isSolved()) {
+                bool optimal = search.best.moveSequence.n <= lowerBound;
+                return finish(search.best, optimal ? SolveStatus::OPTIMAL : SolveStatus::BOUNDED);
+            }
+            return finish(upperBoundSolution, upperBoundSolution.isSolved() ? SolveStatus::BOUNDED : SolveStatus::UNKNOWN);
+        }
+        if (search.best.isSolved()) {
+            return finish(search.best, SolveStatus::OPTIMAL);
+        } else if (iterativeBound + 1 == upperBound) {
+            return finishExhausted();
+        }
+
+        if (options.boundPolicy == BoundPolicy::IDA) {
+            size_t nextBound = search.nextBound;
+            if (nextBound == SIZE_MAX) {
+                return finishExhausted(); // Nothing got cut off, so there is no other solution at all
+            } else if (nextBound >= upperBound || iterativeBound == maxSteps) {
+                return finishExhausted();
+            }
+            provenLowerBound = nextBound;
+            iterativeBound = std::min(std::max(nextBound, iterativeBound + options.boundIncrement), maxSteps);
+        } else {
+            provenLowerBound = iterativeBound + 1;
+            step++;
+            if (step == std::size(boundSteps)) {
+                return finishExhausted();
+            }
+            iterativeBound = boundSteps[step];
+        }
+        lowerBound = std::max(lowerBound, provenLowerBound);
     }
-    return {};
 }
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "SearchStats.hpp"
+
+/**
+ * Progress of the branch and bound search of one level, so that a preempted run can continue
+ * where it stopped. The search tree of an iteration is split into tasks that do not depend on
+ * the number of threads, so the frontier is simply the tasks that are not done yet.
+ * Plain text, one "key value" per line, written to a temporary file and renamed over the old one.
+ */
+struct Checkpoint {
+    std::string board; // Board::encode() of the initial board, to not resume a different level
+    SolveStatus status = SolveStatus::UNKNOWN; // Optimal or unsolvable once the level is done
+    size_t lowerBound = 0;
+    std::string solution; // Best solution so far, of the current iteration while the search runs
+    size_t solutionTask = 0; // Task that found solution, which decides ties
+    size_t iterativeBound = 0;
+    size_t provenLowerBound = 0;
+    size_t step = 0; // Index into the bound steps of BoundPolicy::STEPS
+    size_t nextBound = SIZE_MAX; // Smallest f-value that exceeded the bound in the done tasks
+    std::vector<bool> done; // Tasks of the current iteration that are complete
+    bool table = false; // There is a snapshot of the TranspositionTable next to the checkpoint
+
+    [[nodiscard]] bool finished() const {
+        return status == SolveStatus::OPTIMAL || status == SolveStatus::UNSOLVABLE;
+    }
+
+    void write(const std::filesystem::path &path) const {
+        std::filesystem::path temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream out(temporary);
+            out<<"board "<<board<<"\n"
+               <<"status "<<toString(status)<<"\n"
+               <<"lowerBound "<<lowerBound<<"\n"
+               <<"solution "<<solutionTask<<" "<<(solution.empty() ? "-" : solution)<<"\n"
+               <<"iterativeBound "<<iterativeBound<<"\n"
+               <<"provenLowerBound "<<provenLowerBound<<"\n"
+               <<"step "<<step<<"\n"
+               <<"nextBound "<<nextBound<<"\n"
+               <<"done ";
+            for (bool taskDone : done) {
+                out<<(taskDone ? '1' : '0');
+            }
+            out<<"-\n" // Never an empty word
+               <<"table "<<table<<"\n";
+            if (!out.flush()) {
+                std::cout<<"Unable to write "<<temporary<<std::endl;
+                exit(1);
+            }
+        }
+        std::filesystem::rename(temporary, path);
+    }
+
+    /**
+     * Returns false if there is no checkpoint at path.
+     */
+    bool read(const std::filesystem::path &path) {
+        std::ifstream in(path);
+        if (!in) {
+            return false;
+        }
+        std::string key;
+        while (in>>key) {
+            if (key == "board") {
+                in>>board;
+            } else if (key == "status") {
+                std::string name;
+                in>>name;
+                for (SolveStatus candidate : {SolveStatus::OPTIMAL, SolveStatus::BOUNDED, SolveStatus::UNKNOWN,
+                                              SolveStatus::UNSOLVABLE}) {
+                    if (name == toString(candidate)) {
+                        status = candidate;
+                    }
+                }
+            } else if (key == "lowerBound") {
+                in>>lowerBound;
+            } else if (key == "solution") {
+                in>>solutionTask>>solution;
+                if (solution == "-") {
+                    solution.clear();
+                }
+            } else if (key == "iterativeBound") {
+                in>>iterativeBound;
+            } else if (key == "provenLowerBound") {
+                in>>provenLowerBound;
+            } else if (key == "step") {
+                in>>step;
+            } else if (key == "nextBound") {
+                in>>nextBound;
+            } else if (key == "done") {
+                std::string tasks;
+                in>>tasks;
+                done.clear();
+                for (size_t i = 0; i + 1 < tasks.length(); i++) {
+                    done.push_back(tasks[i] == '1');
+                }
+            } else if (key == "table") {
+                in>>table;
+            } else {
+                std::cout<<"Unknown key "<<key<<" in "<<path<<std::endl;
+                exit(1);
+            }
+            if (!in) {
+                std::cout<<"Unable to read "<<path<<std::endl;
+                exit(1);
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,352 @@
+#pragma once
+
+#include "Board.hpp"
+#include "LayeredSearch.hpp"
+#include "SearchStats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+// States that a StateReader or StateWriter keeps in memory
+constexpr size_t STATE_BUFFER_SIZE = 4096;
+
+/**
+ * Buffered sequential writer for a file of packed states.
+ */
+template<typename State>
+class StateWriter {
+        FILE *file;
+        std::vector<State> buffer;
+
+        void flush() {
+            if (!buffer.empty() && fwrite(buffer.data(), sizeof(State), buffer.size(), file) != buffer.size()) {
+                std::cout<<"Unable to write states"<<std::endl;
+                exit(1);
+            }
+            buffer.clear();
+        }
+
+    public:
+        size_t count = 0;
+
+        explicit StateWriter(const std::filesystem::path &path) {
+            file = fopen(path.c_str(), "wb");
+            if (file == nullptr) {
+                std::cout<<"Unable to create "<<path<<std::endl;
+                exit(1);
+            }
+            buffer.reserve(STATE_BUFFER_SIZE);
+        }
+
+        ~StateWriter() {
+            flush();
+            fclose(file);
+        }
+
+        StateWriter(const StateWriter &) = delete;
+        StateWriter &operator=(const StateWriter &) = delete;
+
+        void write(const State &state) {
+            buffer.push_back(state);
+            count++;
+            if (buffer.size() == buffer.capacity()) {
+                flush();
+            }
+        }
+};
+
+/**
+ * Buffered sequential reader for a file of packed states. current() is valid until next() returns false.
+ */
+template<typename State>
+class StateReader {
+        FILE *file;
+        std::vector<State> buffer = std::vector<State>(STATE_BUFFER_SIZE);
+        size_t position = 0;
+        size_t size = 0;
+
+    public:
+        explicit StateReader(const std::filesystem::path &path) {
+            file = fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                std::cout<<"Unable to open "<<path<<std::endl;
+                exit(1);
+            }
+        }
+
+        ~StateReader() {
+            fclose(file);
+        }
+
+        StateReader(const StateReader &) = delete;
+        StateReader &operator=(const StateReader &) = delete;
+
+        bool next() {
+            position++;
+            if (position >= size) {
+                size = fread(buffer.data(), sizeof(State), buffer.size(), file);
+                position = 0;
+            }
+            return position < size;
+        }
+
+        [[nodiscard]] const State &current() const {
+            return buffer[position];
+        }
+};
+
+/**
+ * Breadth-first search that keeps its layers on disk, for levels whose state space does not fit into memory.
+ *
+ * Every layer is a file of sorted, unique packed states. Children are collected in memory until
+ * the budget is used up, then sorted and written as a run. At the end of a layer, the runs are
+ * merged and every child that is part of an earlier layer is dropped while streaming through
+ * those layer files alongside (delayed duplicate detection). Every open file has a buffer, so
+ * a pass only reads as many files as the budget allows (and never more than MAX_MERGE_FILES);
+ * with more runs and earlier layers than that, it takes several passes through intermediate runs.
+ * Only the solution's path is not stored: it is found again backwards, by searching each earlier
+ * layer for a parent.
+ */
+template<size_t rows, size_t cols>
+class ExternalBfs {
+        using State = typename Board<rows, cols>::Packed;
+        using Reader = StateReader<State>;
+        using Writer = StateWriter<State>;
+
+        static constexpr size_t MAX_MERGE_FILES = 64; // Keeps well below the limit of open files
+        static constexpr size_t FILE_BUFFER_BYTES = STATE_BUFFER_SIZE * sizeof(State);
+
+        size_t levelNr;
+        Board<rows, cols> initialBoard;
+        std::filesystem::path directory;
+        size_t maxBufferedStates; // Children that are sorted at once, next to a reader and a writer
+        size_t maxMergeFiles; // Files that one merge pass reads at once, next to its writer
+        std::ostream &log;
+        std::vector<std::filesystem::path> layers;
+        size_t numRuns = 0; // Runs ever written, for their names
+        std::string prefix;
+
+        [[nodiscard]] std::filesystem::path layerPath(size_t depth) const {
+            return directory / (prefix + "-layer-" + std::to_string(depth) + ".states");
+        }
+
+        [[nodiscard]] std::filesystem::path runPath(size_t run) const {
+            return directory / (prefix + "-run-" + std::to_string(run) + ".states");
+        }
+
+        void writeRun(std::vector<State> &buffer, std::vector<std::filesystem::path> &runs) {
+            std::sort(buffer.begin(), buffer.end());
+            runs.push_back(runPath(numRuns++));
+            Writer writer(runs.back());
+            for (size_t i = 0; i < buffer.size(); i++) {
+                if (i == 0 || buffer[i] != buffer[i - 1]) {
+                    writer.write(buffer[i]);
+                }
+            }
+            buffer.clear();
+        }
+
+        /**
+         * Merges the sorted inputs into output, without duplicates and without anything that one of
+         * the sorted files in known contains. Returns the number of states written.
+         */
+        size_t merge(const std::vector<std::filesystem::path> &inputs, const std::vector<std::filesystem::path> &known,
+                     const std::filesystem::path &output) {
+            std::vector<std::unique_ptr<Reader>> inputReaders;
+            auto greater = [&](size_t a, size_t b) {
+                return inputReaders[b]->current() < inputReaders[a]->current();
+            };
+            std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+            for (const std::filesystem::path &input : inputs) {
+                inputReaders.push_back(std::make_unique<Reader>(input));
+                if (inputReaders.back()->next()) {
+                    heap.push(inputReaders.size() - 1);
+                }
+            }
+            std::vector<std::unique_ptr<Reader>> knownReaders;
+            std::vector<bool> knownLeft;
+            for (const std::filesystem::path &file : known) {
+                knownReaders.push_back(std::make_unique<Reader>(file));
+                knownLeft.push_back(knownReaders.back()->next());
+            }
+
+            Writer writer(output);
+            State previous;
+            bool first = true;
+            while (!heap.empty()) {
+                size_t input = heap.top();
+                heap.pop();
+                State state = inputReaders[input]->current();
+                if (inputReaders[input]->next()) {
+                    heap.push(input);
+                }
+                if (!first && state == previous) {
+                    continue;
+                }
+                first = false;
+                previous = state;
+
+                bool isKnown = false;
+                for (size_t i = 0; i < knownReaders.size(); i++) {
+                    while (knownLeft[i] && knownReaders[i]->current() < state) {
+                        knownLeft[i] = knownReaders[i]->next();
+                    }
+                    isKnown |= knownLeft[i] && knownReaders[i]->current() == state;
+                }
+                if (!isKnown) {
+                    writer.write(state);
+                }
+            }
+            return writer.count;
+        }
+
+        /**
+         * Merges the runs into the file of the next layer, without duplicates and without anything
+         * an earlier layer already contains, and removes them. Returns the number of states written.
+         */
+        size_t mergeRuns(std::vector<std::filesystem::path> runs) {
+            std::vector<std::filesystem::path> earlier = layers;
+            while (runs.size() + earlier.size() > maxMergeFiles) {
+                // Runs first, so that the earlier layers are compared with fewer states
+                size_t numInputs = std::min(runs.size(), maxMergeFiles);
+                size_t numKnown = std::min(earlier.size(), maxMergeFiles - numInputs);
+                std::vector<std::filesystem::path> inputs(runs.begin(), runs.begin() + numInputs);
+                std::vector<std::filesystem::path> known(earlier.begin(), earlier.begin() + numKnown);
+                runs.erase(runs.begin(), runs.begin() + numInputs);
+                earlier.erase(earlier.begin(), earlier.begin() + numKnown);
+                runs.push_back(runPath(numRuns++));
+                merge(inputs, known, runs.back());
+                for (const std::filesystem::path &input : inputs) {
+                    std::filesystem::remove(input);
+                }
+            }
+            layers.push_back(layerPath(layers.size()));
+            size_t layerSize = merge(runs, earlier, layers.back());
+            for (const std::filesystem::path &run : runs) {
+                std::filesystem::remove(run);
+            }
+            return layerSize;
+        }
+
+        /**
+         * Searches the given layer for a state that reaches target with one click.
+         */
+        void findParent(size_t depth, State &target, std::vector<uint8_t> &path) {
+            Board<rows, cols> board = initialBoard;
+            Reader reader(layers[depth]);
+            while (reader.next()) {
+                board.unpack(reader.current());
+                bool found = forEachChild(board, [&](size_t cell) {
+                    if (board.pack() == target) {
+                        path.push_back(cell);
+                        return true;
+                    }
+                    return false;
+                });
+                if (found) {
+                    target = reader.current();
+                    return;
+                }
+            }
+            std::cout<<"Lost the parent of a state"<<std::endl;
+            exit(1);
+        }
+
+        Board<rows, cols> rebuildSolution(size_t depth, State parent, size_t lastMove) {
+            std::vector<uint8_t> path = {uint8_t(lastMove)};
+            for (; depth > 0; depth--) {
+                findParent(depth - 1, parent, path);
+            }
+            return clickBackwards(initialBoard, path);
+        }
+
+    public:
+        ExternalBfs(size_t levelNr, const Board<rows, cols> &initialBoard, const std::filesystem::path &directory,
+                    size_t memoryBytes, std::ostream &log)
+                : levelNr(levelNr), initialBoard(initialBoard), directory(directory),
+                  maxBufferedStates(std::max(memoryBytes, 3 * FILE_BUFFER_BYTES) / sizeof(State) - 2 * STATE_BUFFER_SIZE),
+                  maxMergeFiles(std::clamp<size_t>(memoryBytes / FILE_BUFFER_BYTES, 3, MAX_MERGE_FILES + 1) - 1),
+                  log(log) {
+            static std::atomic<size_t> searches = 0; // Levels can be solved in parallel
+            prefix = "level-" + std::to_string(levelNr) + "-" + std::to_string(searches++);
+        }
+
+        ~ExternalBfs() {
+            for (const std::filesystem::path &layer : layers) {
+                std::filesystem::remove(layer);
+            }
+        }
+
+        ExternalBfs(const ExternalBfs &) = delete;
+        ExternalBfs &operator=(const ExternalBfs &) = delete;
+
+        Board<rows, cols> solve() {
+            if (initialBoard.isSolved()) {
+                return initialBoard;
+            }
+            layers.push_back(layerPath(0));
+            Writer(layers.back()).write(initialBoard.pack());
+
+            for (size_t steps = 1; steps <= maxSteps; steps++) {
+                std::vector<State> buffer;
+                buffer.reserve(maxBufferedStates); // Pages are only used once they are written
+                std::vector<std::filesystem::path> runs;
+                Board<rows, cols> board = initialBoard;
+                Reader reader(layers.back());
+                while (reader.next()) {
+                    board.unpack(reader.current());
+                    size_t solvingMove = 0;
+                    bool solved = forEachChild(board, [&](size_t cell) {
+                        if (board.isSolved()) {
+                            solvingMove = cell;
+                            return true;
+                        }
+                        buffer.push_back(board.pack());
+                        if (buffer.size() == maxBufferedStates) {
+                            writeRun(buffer, runs);
+                        }
+                        return false;
+                    });
+                    if (solved) {
+                        for (const std::filesystem::path &run : runs) {
+                            std::filesystem::remove(run);
+                        }
+                        return rebuildSolution(steps - 1, reader.current(), solvingMove);
+                    }
+                }
+                writeRun(buffer, runs);
+                buffer = {}; // The merge has the memory to itself
+
+                size_t layerSize = mergeRuns(runs);
+                if (layerSize == 0) {
+                    return {};
+                }
+                if (steps > 5) {
+                    log<<"# Calculating solutions for "<<levelNr<<", currently at "
+                       <<steps<<" steps. Layer size: "<<layerSize<<std::endl;
+                }
+            }
+            return {};
+        }
+};
+
+/**
+ * Never gives up, so stats has the status optimal or unsolvable.
+ */
+template<size_t rows, size_t cols>
+Board<rows, cols> solveExternalBFS(size_t levelNr, const Board<rows, cols> &initialBoard, const std::filesystem::path &directory,
+                                   size_t memoryBytes, std::ostream &log = std::cout, SolveStats *stats = nullptr) {
+    ExternalBfs<rows, cols> search(levelNr, initialBoard, directory, memoryBytes, log);
+    Board<rows, cols> solved = search.solve();
+    if (stats != nullptr) {
+        stats->status = solved.isSolved() ? SolveStatus::OPTIMAL : SolveStatus::UNSOLVABLE;
+        stats->lowerBound = solved.isSolved() ? solved.moveSequence.n : maxSteps + 1;
+    }
+    return solved;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "Board.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+// Pieces that the searches which go layer by layer share: solveBFS(), ExternalBfs and beamSearch()
+
+/**
+ * Open addressing set of 64 bit hashes with linear probing. 0 marks free slots,
+ * so the (unlikely) hash 0 is stored as 1.
+ */
+class HashSet {
+        std::vector<uint64_t> slots = std::vector<uint64_t>(1024);
+        size_t count = 0;
+
+        void grow() {
+            std::vector<uint64_t> old(slots.size() * 2);
+            std::swap(old, slots);
+            for (uint64_t key : old) {
+                if (key != 0) {
+                    size_t index = key & (slots.size() - 1);
+                    while (slots[index] != 0) {
+                        index = (index + 1) & (slots.size() - 1);
+                    }
+                    slots[index] = key;
+                }
+            }
+        }
+
+    public:
+        [[nodiscard]] bool contains(uint64_t key) const {
+            key = std::max<uint64_t>(key, 1);
+            for (size_t index = key & (slots.size() - 1); slots[index] != 0; index = (index + 1) & (slots.size() - 1)) {
+                if (slots[index] == key) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Returns false if the key was already present.
+         */
+        bool insert(uint64_t key) {
+            if (2 * (count + 1) > slots.size()) {
+                grow();
+            }
+            key = std::max<uint64_t>(key, 1);
+            size_t index = key & (slots.size() - 1);
+            while (slots[index] != 0) {
+                if (slots[index] == key) {
+                    return false;
+                }
+                index = (index + 1) & (slots.size() - 1);
+            }
+            slots[index] = key;
+            count++;
+            return true;
+        }
+};
+
+/**
+ * Calls visit(cell) for every click that changes the board, by cell, with the board as the click
+ * left it. The board is restored after every click. Stops as soon as visit returns true, and
+ * returns whether it did.
+ */
+template<size_t rows, size_t cols, typename F>
+bool forEachChild(Board<rows, cols> &board, F visit) {
+    uint64_t clickable = board.clickableCells();
+    while (clickable) {
+        size_t cell = std::countr_zero(clickable);
+        clickable &= clickable - 1;
+        Undo undo;
+        bool stop = board.make(cell / cols, cell % cols, undo) && visit(cell);
+        board.unmake(undo);
+        if (stop) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Clicks the cells of path, which lists them from the last click back to the first.
+ */
+template<size_t rows, size_t cols>
+Board<rows, cols> clickBackwards(Board<rows, cols> board, const std::vector<uint8_t> &path) {
+    for (auto move = path.rbegin(); move != path.rend(); move++) {
+        board.click(*move / cols, *move % cols);
+    }
+    return board;
+}
+
+/**
+ * Parent and move of every state that a search kept, by the index of the state, to rebuild the
+ * path to a solution. The initial board has index 0.
+ */
+class ParentChain {
+        std::vector<uint32_t> parents = {0};
+        std::vector<uint8_t> moves = {0};
+
+    public:
+        [[nodiscard]] size_t size() const {
+            return parents.size();
+        }
+
+        void push(uint32_t parent, uint8_t move) {
+            parents.push_back(parent);
+            moves.push_back(move);
+        }
+
+        /**
+         * Board after the moves that lead to the state with the given index, and then lastMove.
+         */
+        template<size_t rows, size_t cols>
+        Board<rows, cols> solution(const Board<rows, cols> &initialBoard, size_t index, size_t lastMove) const {
+            std::vector<uint8_t> path = {uint8_t(lastMove)};
+            for (; index != 0; index = parents[index]) {
+                path.push_back(moves[index]);
+            }
+            return clickBackwards(initialBoard, path);
+        }
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Read-only memory mapping of a whole file. Views into contents() stay valid as long as the object lives.
+ */
+class MappedFile {
+        const char *data = nullptr;
+        size_t size = 0;
+
+    public:
+        explicit MappedFile(const char *path) {
+            int fd = open(path, O_RDONLY);
+            struct stat status;
+            if (fd < 0 || fstat(fd, &status) != 0) {
+                std::cout<<"Unable to open "<<path<<std::endl;
+                exit(1);
+            }
+            size = status.st_size;
+            if (size > 0) {
+                void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (memory == MAP_FAILED) {
+                    std::cout<<"Unable to map "<<path<<std::endl;
+                    exit(1);
+                }
+                madvise(memory, size, MADV_SEQUENTIAL); // Only a hint, failure is fine
+                data = static_cast<const char *>(memory);
+            }
+            close(fd);
+        }
+
+        ~MappedFile() {
+            if (data != nullptr) {
+                munmap(const_cast<char *>(data), size);
+            }
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        [[nodiscard]] std::string_view contents() const {
+            return {data, size};
+        }
+};
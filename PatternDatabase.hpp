@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+#include "Board.hpp"
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+/**
+ * Lower bounds from exactly solved relaxations of one level, built before its search starts.
+ *
+ * In the relaxation, a click fills any cells of its color that the clickable could ever reach,
+ * all at once. Rotating arrows count as one clickable per direction. The clicks needed for the
+ * incorrect cells of a color are then the fewest reach sets that cover them. Target cells are
+ * split into groups of up to maxGroupCells cells of one color, and the cover is solved for every
+ * subset of a group up front. Every click fills a single color, so colors add up, while groups
+ * of the same color only give their maximum.
+ */
+template<size_t rows, size_t cols>
+class PatternDatabase {
+        static constexpr size_t maxGroupCells = 18;
+
+        struct Group {
+            size_t color;
+            uint64_t cells;
+            std::vector<uint8_t> clicksNeeded; // By subset of cells, see indexOf()
+        };
+
+        std::vector<Group> groups;
+        bool hasBombs;
+
+        /**
+         * Packs the bits of subset that are in cells into the low bits, keeping their order.
+         * That is a single pext where BMI2 is available (make native).
+         */
+        static size_t indexOf(uint64_t cells, uint64_t subset) {
+#ifdef __BMI2__
+            return _pext_u64(subset, cells);
+#else
+            size_t index = 0;
+            while (subset) {
+                uint64_t bit = subset & -subset;
+                index |= size_t(1) << std::popcount(cells & (bit - 1));
+                subset ^= bit;
+            }
+            return index;
+#endif
+        }
+
+        /**
+         * Smallest number of sets that cover each subset of the group, by dynamic programming:
+         * the lowest cell of a subset has to be covered by one of the sets that contain it.
+         */
+        static std::vector<uint8_t> solveCover(uint64_t cells, const std::vector<uint64_t> &sets) {
+            size_t numCells = std::popcount(cells);
+            std::vector<std::vector<size_t>> setsWith(numCells);
+            for (uint64_t set : sets) {
+                size_t index = indexOf(cells, set & cells);
+                for (size_t cell = 0; cell < numCells; cell++) {
+                    if (index & (size_t(1) << cell)) {
+                        setsWith[cell].push_back(index);
+                    }
+                }
+            }
+            std::vector<uint8_t> clicksNeeded(size_t(1) << numCells);
+            for (size_t subset = 1; subset < clicksNeeded.size(); subset++) {
+                uint8_t best = UINT8_MAX - 1;
+                for (size_t set : setsWith[std::countr_zero(subset)]) {
+                    best = std::min(best, clicksNeeded[subset & ~set]);
+                }
+                clicksNeeded[subset] = best + 1;
+            }
+            return clicksNeeded;
+        }
+
+    public:
+        explicit PatternDatabase(const BoardLayout<rows, cols> &layout) : hasBombs(layout.hasBombs) {
+            typename Board<rows, cols>::ReachabilityArray reachableFrom;
+            Board<rows, cols>::computeReachability(layout, reachableFrom);
+            for (size_t color = 0; color < numColors; color++) {
+                uint64_t reach[rows * cols][4] = {}; // By clickable and Direction (rotating arrows only)
+                uint64_t targets = layout.targets[color];
+                while (targets) {
+                    size_t cell = std::countr_zero(targets);
+                    targets &= targets - 1;
+                    size_t row = cell / cols;
+                    size_t col = cell % cols;
+                    for (Position source : reachableFrom[row][col]) {
+                        size_t direction = 0;
+                        if (layout.rotatingArrows & Geometry<rows, cols>::cellBit(source.row, source.col)) {
+                            if (row == source.row) {
+                                direction = col < source.col ? LEFT : RIGHT;
+                            } else {
+                                direction = row < source.row ? UP : DOWN;
+                            }
+                        }
+                        reach[source.row * cols + source.col][direction] |= Geometry<rows, cols>::cellBit(row, col);
+                    }
+                }
+                std::vector<uint64_t> sets;
+                uint64_t coverable = 0;
+                for (auto &byDirection : reach) {
+                    for (uint64_t set : byDirection) {
+                        if (set) {
+                            sets.push_back(set);
+                            coverable |= set;
+                        }
+                    }
+                }
+                while (coverable) {
+                    uint64_t cells = 0;
+                    for (size_t i = 0; i < maxGroupCells && coverable; i++) {
+                        cells |= coverable & -coverable;
+                        coverable &= coverable - 1;
+                    }
+                    groups.push_back({color, cells, solveCover(cells, sets)});
+                }
+            }
+        }
+
+        [[nodiscard]] size_t lowerBound(const Board<rows, cols> &board) const {
+            uint64_t incorrect = board.incorrectCells();
+            size_t clicksNeeded[numColors] = {};
+            for (const Group &group : groups) {
+                size_t index = indexOf(group.cells, incorrect & group.cells);
+                clicksNeeded[group.color] = std::max<size_t>(clicksNeeded[group.color], group.clicksNeeded[index]);
+            }
+            size_t total = 0;
+            for (size_t clicks : clicksNeeded) {
+                total += clicks;
+            }
+            if (!hasBombs) {
+                total += std::popcount(board.colorsNeedingRemoval()); // Clicks that remove a color cannot fill
+            }
+            return total;
+        }
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "Board.hpp"
+
+/**
+ * Counters of the branch and bound search. Every worker counts into its own copy, which is
+ * added to the totals of the search once its task is done, so the hot path never shares them.
+ */
+struct SearchStats {
+    uint64_t nodes = 0; // Calls of branch()
+    uint64_t transpositionHits = 0;
+    uint64_t transpositionMisses = 0;
+    uint64_t transpositionOverwrites = 0; // Stores that evicted another state
+    uint64_t prunedByBound = 0; // Already as long as the best solution
+    uint64_t prunedByHeuristic = 0; // Lower bound reaches the best solution
+    uint64_t prunedByTransposition = 0; // Reached before with fewer moves, or by a task that wins ties
+    uint64_t noOpClicks = 0; // Clicks that did not change anything
+    uint64_t expandedByDepth[maxSteps + 1] = {};
+    uint64_t childrenByDepth[maxSteps + 1] = {};
+
+    void add(const SearchStats &other) {
+        nodes += other.nodes;
+        transpositionHits += other.transpositionHits;
+        transpositionMisses += other.transpositionMisses;
+        transpositionOverwrites += other.transpositionOverwrites;
+        prunedByBound += other.prunedByBound;
+        prunedByHeuristic += other.prunedByHeuristic;
+        prunedByTransposition += other.prunedByTransposition;
+        noOpClicks += other.noOpClicks;
+        for (size_t depth = 0; depth <= maxSteps; depth++) {
+            expandedByDepth[depth] += other.expandedByDepth[depth];
+            childrenByDepth[depth] += other.childrenByDepth[depth];
+        }
+    }
+};
+
+enum class SolveStatus {
+    OPTIMAL, // No shorter solution exists
+    BOUNDED, // Stopped by a limit, there is a solution but maybe a shorter one
+    UNKNOWN, // Stopped by a limit before any solution was found
+    UNSOLVABLE // No solution within maxSteps moves
+};
+
+inline const char *toString(SolveStatus status) {
+    switch (status) {
+        case SolveStatus::OPTIMAL: return "optimal";
+        case SolveStatus::BOUNDED: return "bounded";
+        case SolveStatus::UNKNOWN: return "unknown";
+        default: return "unsolvable";
+    }
+}
+
+struct IterationStats {
+    size_t bound;
+    double seconds;
+    uint64_t nodes;
+};
+
+/**
+ * Everything measured while solving one level, written as one line of JSON.
+ */
+struct SolveStats {
+    size_t levelNr = 0;
+    size_t moves = 0; // Of the solution, 0 if there is none
+    SolveStatus status = SolveStatus::UNKNOWN;
+    size_t lowerBound = 0; // No solution is shorter
+    double seconds = 0;
+    double searchSeconds = 0; // Of the branch and bound search alone, without the pattern database and beam search
+    size_t beamSolution = 0; // Moves of the beam search solution, 0 if there is none
+    SearchStats search;
+    std::vector<IterationStats> iterations;
+
+    void writeJson(std::ostream &out) const {
+        out<<"{\"level\":"<<levelNr<<",\"moves\":"<<moves<<",\"status\":\""<<toString(status)
+           <<"\",\"lowerBound\":"<<lowerBound<<",\"seconds\":"<<seconds<<",\"searchSeconds\":"<<searchSeconds
+           <<",\"nodes\":"<<search.nodes
+           <<",\"nodesPerSecond\":"<<(searchSeconds > 0 ? uint64_t(search.nodes / searchSeconds) : 0)
+           <<",\"beamSolution\":"<<beamSolution
+           <<",\"transpositionTable\":{\"hits\":"<<search.transpositionHits<<",\"misses\":"<<search.transpositionMisses
+           <<",\"overwrites\":"<<search.transpositionOverwrites<<"}"
+           <<",\"pruned\":{\"bound\":"<<search.prunedByBound<<",\"heuristic\":"<<search.prunedByHeuristic
+           <<",\"transposition\":"<<search.prunedByTransposition<<",\"noOpClick\":"<<search.noOpClicks<<"}"
+           <<",\"branchingFactor\":[";
+        size_t depths = maxSteps + 1;
+        while (depths > 0 && search.expandedByDepth[depths - 1] == 0) {
+            depths--;
+        }
+        for (size_t depth = 0; depth < depths; depth++) {
+            uint64_t expanded = search.expandedByDepth[depth];
+            out<<(depth > 0 ? "," : "")<<(expanded > 0 ? double(search.childrenByDepth[depth]) / expanded : 0.0);
+        }
+        out<<"],\"iterations\":[";
+        for (size_t i = 0; i < iterations.size(); i++) {
+            out<<(i > 0 ? "," : "")<<"{\"bound\":"<<iterations[i].bound<<",\"seconds\":"<<iterations[i].seconds
+               <<",\"nodes\":"<<iterations[i].nodes<<"}";
+        }
+        out<<"]}\n";
+    }
+};
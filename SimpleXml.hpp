@@ -1,83 +1,158 @@
 #pragma once
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <iostream>
 
+/**
+ * One <level /> element. All strings point into the parsed file and are not copied,
+ * except for color and modifier values that are broken up by whitespace.
+ */
+struct LevelRecord {
+    size_t number = 0;
+    std::string_view solution;
+    std::string_view author;
+    std::string_view color;
+    std::string_view modifier;
+    std::shared_ptr<const std::string> withoutWhitespace; // Color and modifier, if they had to be copied
+};
+
 class SimpleXml {
     public:
-        static void skipWhitespace(std::string &xml, size_t &pos) {
-            while (xml[pos] == ' ' || xml[pos] == '\n') {
+        static void skipWhitespace(std::string_view xml, size_t &pos) {
+            while (pos < xml.length() && isWhitespace(xml[pos])) {
                 pos++;
             }
         }
 
-        static void skipToQuote(std::string &xml, size_t &pos) {
-            while (xml[pos] != '"') {
-                pos++;
-            }
-            pos++;
+        static bool isWhitespace(char c) {
+            return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+        }
+
+        static bool startsWith(std::string_view str, std::string_view xml, size_t pos) {
+            return xml.substr(pos, str.length()) == str;
         }
 
-        static void consume(char c, std::string &xml, size_t &pos) {
-            if (pos >= xml.length()) {
+        static void consume(std::string_view str, std::string_view xml, size_t &pos) {
+            if (pos + str.length() > xml.length()) {
                 std::cout << "EOF" << std::endl;
                 exit(1);
             }
-            if (xml[pos] != c) {
-                std::cout << "Expected " << c << std::endl;
+            if (!startsWith(str, xml, pos)) {
+                std::cout << "Expected " << str << std::endl;
                 exit(1);
             }
-            pos++;
+            pos += str.length();
         }
 
-        static void consume(const std::string &str, std::string &xml, size_t &pos) {
-            for (char c: str) {
-                consume(c, xml, pos);
+        /**
+         * Returns the quoted value at pos and moves behind the closing quote.
+         */
+        static std::string_view quoted(std::string_view xml, size_t &pos) {
+            consume("\"", xml, pos);
+            size_t end = xml.find('"', pos);
+            if (end == std::string_view::npos) {
+                std::cout << "EOF" << std::endl;
+                exit(1);
             }
+            std::string_view value = xml.substr(pos, end - pos);
+            pos = end + 1;
+            return value;
         }
 
-        static std::tuple<size_t, std::string, std::string, bool> parseBoardXml(std::string &xml, size_t &pos) {
-            skipWhitespace(xml, pos);
-            consume("<level number=\"", xml, pos);
-            size_t levelNr = 0;
-            while (xml[pos] >= '0' && xml[pos] <= '9') {
-                levelNr *= 10;
-                levelNr += xml[pos] - '0';
-                pos++;
+        /**
+         * Removes whitespace from the color and modifier of the record, which long boards
+         * are sometimes wrapped with. Only those records get their own copy of the strings.
+         */
+        static void removeWhitespace(LevelRecord &record) {
+            auto hasWhitespace = [](std::string_view value) {
+                return std::find_if(value.begin(), value.end(), isWhitespace) != value.end();
+            };
+            if (!hasWhitespace(record.color) && !hasWhitespace(record.modifier)) {
+                return;
             }
-            consume('"', xml, pos);
+            auto copy = std::make_shared<std::string>();
+            std::copy_if(record.color.begin(), record.color.end(), std::back_inserter(*copy), std::not_fn(isWhitespace));
+            size_t colorLength = copy->length();
+            std::copy_if(record.modifier.begin(), record.modifier.end(), std::back_inserter(*copy), std::not_fn(isWhitespace));
+            record.color = std::string_view(*copy).substr(0, colorLength);
+            record.modifier = std::string_view(*copy).substr(colorLength);
+            record.withoutWhitespace = std::move(copy);
+        }
+
+        /**
+         * Consumes the header up to and including <levels>.
+         */
+        static void parseHeader(std::string_view xml, size_t &pos) {
             skipWhitespace(xml, pos);
-            bool hasSolution = false;
-            if (xml[pos] == 's') {
-                consume("solution=\"", xml, pos);
-                skipToQuote(xml, pos);
+            if (startsWith("<?xml", xml, pos)) {
+                pos = xml.find("?>", pos);
+                if (pos == std::string_view::npos) {
+                    std::cout << "EOF" << std::endl;
+                    exit(1);
+                }
+                pos += 2;
                 skipWhitespace(xml, pos);
-                hasSolution = true;
             }
-            if (xml[pos] == 'a') {
-                consume("author=\"", xml, pos);
-                skipToQuote(xml, pos);
-                skipWhitespace(xml, pos);
+            consume("<levels>", xml, pos);
+        }
+
+        /**
+         * Parses the next level into record. Returns false once </levels> is reached.
+         */
+        static bool parseLevel(std::string_view xml, size_t &pos, LevelRecord &record) {
+            skipWhitespace(xml, pos);
+            if (startsWith("</levels>", xml, pos)) {
+                pos += 9;
+                return false;
             }
-            consume("color=\"", xml, pos);
-            std::string color = "";
-            while (xml[pos] != '"') {
+            consume("<level", xml, pos);
+            record = {};
+            while (true) {
                 skipWhitespace(xml, pos);
-                color += xml[pos];
-                pos++;
+                if (startsWith("/>", xml, pos)) {
+                    pos += 2;
+                    break;
+                }
+                size_t nameEnd = xml.find('=', pos);
+                if (nameEnd == std::string_view::npos) {
+                    std::cout << "EOF" << std::endl;
+                    exit(1);
+                }
+                std::string_view name = xml.substr(pos, nameEnd - pos);
+                pos = nameEnd + 1;
+                std::string_view value = quoted(xml, pos);
+                if (name == "number") {
+                    for (char c : value) {
+                        if (c < '0' || c > '9') {
+                            std::cout << "Invalid level number " << value << std::endl;
+                            exit(1);
+                        }
+                        record.number = record.number * 10 + (c - '0');
+                    }
+                } else if (name == "solution") {
+                    record.solution = value;
+                } else if (name == "author") {
+                    record.author = value;
+                } else if (name == "color") {
+                    record.color = value;
+                } else if (name == "modifier") {
+                    record.modifier = value;
+                } else {
+                    std::cout << "Unknown attribute " << name << std::endl;
+                    exit(1);
+                }
             }
-            pos++;
-            skipWhitespace(xml, pos);
-            consume("modifier=\"", xml, pos);
-            std::string modifier = "";
-            while (xml[pos] != '"') {
-                skipWhitespace(xml, pos);
-                modifier += xml[pos];
-                pos++;
+            removeWhitespace(record);
+            size_t size = record.color.length();
+            if ((size != 5 * 6 && size != 6 * 8) || record.modifier.length() != size) {
+                std::cout << "Unexpected board size in level " << record.number << std::endl;
+                exit(1);
             }
-            pos++;
-            skipWhitespace(xml, pos);
-            consume("/>", xml, pos);
-            return std::make_tuple(levelNr, color, modifier, hasSolution);
+            return true;
         }
 };
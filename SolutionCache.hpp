@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "Board.hpp"
+#include "MappedFile.hpp"
+#include "SearchStats.hpp"
+
+/**
+ * Results of earlier runs, by Board::encode() of the level, so that a level is only solved once
+ * and a level that ran into a limit continues from the lower bound it reached.
+ *
+ * The file is only ever appended to, one line per result: board, status, lower bound, solution
+ * (or -) and the VERSION of the solver. Later lines replace earlier ones of the same board, and
+ * lines of other versions are ignored. Every line is flushed on its own, so a killed run loses
+ * at most the line it was writing, which is cut off when the file is opened again.
+ * Nothing here knows the boards, so the caller has to check solutions before trusting them.
+ */
+class SolutionCache {
+    public:
+        // Increase whenever a change could make earlier results wrong
+        static constexpr size_t VERSION = 2;
+
+        struct Entry {
+            SolveStatus status = SolveStatus::UNKNOWN;
+            size_t lowerBound = 0;
+            std::string solution; // Best one known, optimal or not
+
+            [[nodiscard]] bool finished() const {
+                return status == SolveStatus::OPTIMAL || status == SolveStatus::UNSOLVABLE;
+            }
+
+            [[nodiscard]] size_t moves() const {
+                return solution.empty() ? SIZE_MAX : std::count(solution.begin(), solution.end(), ',') + 1;
+            }
+
+            /**
+             * Combines what two runs found: the higher lower bound and the shorter solution,
+             * which is optimal once they meet.
+             */
+            [[nodiscard]] Entry merge(const Entry &other) const {
+                if (finished()) {
+                    return *this;
+                } else if (other.finished()) {
+                    return other;
+                }
+                Entry merged;
+                merged.lowerBound = std::max(lowerBound, other.lowerBound);
+                merged.solution = other.moves() < moves() ? other.solution : solution;
+                if (merged.solution.empty()) {
+                    merged.status = SolveStatus::UNKNOWN;
+                } else {
+                    merged.status = merged.moves() <= merged.lowerBound ? SolveStatus::OPTIMAL : SolveStatus::BOUNDED;
+                    merged.lowerBound = std::min(merged.lowerBound, merged.moves());
+                }
+                return merged;
+            }
+
+            bool operator==(const Entry &other) const = default;
+        };
+
+    private:
+        std::unordered_map<std::string, Entry> entries;
+        std::mutex mutex;
+        FILE *file;
+
+        static SolveStatus parseStatus(std::string_view name) {
+            for (SolveStatus status : {SolveStatus::OPTIMAL, SolveStatus::BOUNDED, SolveStatus::UNSOLVABLE}) {
+                if (name == toString(status)) {
+                    return status;
+                }
+            }
+            return SolveStatus::UNKNOWN;
+        }
+
+        /**
+         * Returns the length of the complete lines.
+         */
+        size_t parse(std::string_view contents) {
+            size_t pos = 0;
+            while (pos < contents.length()) {
+                size_t end = contents.find('\n', pos);
+                if (end == std::string_view::npos) {
+                    break; // Cut off by a killed run
+                }
+                std::string_view line = contents.substr(pos, end - pos);
+                pos = end + 1;
+                std::string_view fields[5];
+                size_t numFields = 0;
+                for (size_t start = 0; start <= line.length() && numFields < std::size(fields);) {
+                    size_t space = std::min(line.find(' ', start), line.length());
+                    fields[numFields++] = line.substr(start, space - start);
+                    start = space + 1;
+                }
+                if (numFields != std::size(fields) || fields[4] != std::to_string(VERSION)) {
+                    continue;
+                }
+                Entry entry;
+                entry.status = parseStatus(fields[1]);
+                entry.lowerBound = std::strtoul(std::string(fields[2]).c_str(), nullptr, 10);
+                entry.solution = fields[3] == "-" ? "" : std::string(fields[3]);
+                entries[std::string(fields[0])] = entry;
+            }
+            return pos;
+        }
+
+    public:
+        explicit SolutionCache(const char *path) {
+            if (std::filesystem::exists(path)) {
+                size_t length;
+                size_t complete;
+                {
+                    MappedFile existing(path);
+                    length = existing.contents().length();
+                    complete = parse(existing.contents());
+                }
+                if (complete < length) {
+                    // Appending to the line of a killed run would glue the next one to it
+                    std::filesystem::resize_file(path, complete);
+                }
+            }
+            file = fopen(path, "a");
+            if (file == nullptr) {
+                std::cout<<"Unable to open "<<path<<std::endl;
+                exit(1);
+            }
+        }
+
+        ~SolutionCache() {
+            fclose(file);
+        }
+
+        SolutionCache(const SolutionCache &) = delete;
+        SolutionCache &operator=(const SolutionCache &) = delete;
+
+        bool find(const std::string &board, Entry &entry) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(board);
+            if (it == entries.end()) {
+                return false;
+            }
+            entry = it->second;
+            return true;
+        }
+
+        /**
+         * Drops what is known about the board, for example a solution that turned out to be wrong.
+         * The next store() replaces it in the file as well.
+         */
+        void forget(const std::string &board) {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.erase(board);
+        }
+
+        /**
+         * Merges the result into what is known about the board, and appends it to the file if
+         * that changed anything. Returns the merged entry.
+         */
+        Entry store(const std::string &board, const Entry &result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(board);
+            Entry merged = it == entries.end() ? result : it->second.merge(result);
+            if (it != entries.end() && merged == it->second) {
+                return merged;
+            }
+            entries[board] = merged;
+            std::string line = board + " " + toString(merged.status) + " " + std::to_string(merged.lowerBound) + " "
+                    + (merged.solution.empty() ? "-" : merged.solution) + " " + std::to_string(VERSION) + "\n";
+            if (fwrite(line.data(), 1, line.length(), file) != line.length() || fflush(file) != 0) {
+                std::cout<<"Unable to write the solution cache"<<std::endl;
+                exit(1);
+            }
+            return merged;
+        }
+};
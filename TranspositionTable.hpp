@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <sys/mman.h>
+
+/**
+ * Lock-free transposition table for the branch and bound search.
+ *
+ * Buckets hold 4 entries and fill exactly one cache line. Every slot stores the packed data
+ * and key ^ data in two independent 64 bit atomics. A reader only accepts a slot if both
+ * words belong together, so torn writes of concurrent stores are rejected instead of
+ * returning the data of another state.
+ *
+ * The table is an anonymous mapping that is neither touched nor zero-filled up front.
+ * Pages are backed (by transparent huge pages, if possible) as the search reaches them.
+ */
+class TranspositionTable {
+    public:
+        struct Entry {
+            static constexpr uint8_t ALL_CLICKS = 0x7f;
+
+            uint8_t moves = 0; // Fewest moves the state was reached with
+            uint32_t task = 0; // Task that expands the state, see branch()
+            uint32_t epoch = 0; // Bound step that stored the entry
+            uint8_t lowerBound = 0; // Moves that are proven to be needed from this state on
+            uint8_t lastClick = ALL_CLICKS; // Expanded without the clicks that commute with this one, see branch()
+        };
+
+    private:
+        static constexpr size_t WAYS = 4;
+        static constexpr uint32_t EPOCH_MASK = (1 << 24) - 1;
+        static constexpr uint32_t TASK_MASK = (1 << 17) - 1; // There are far fewer tasks
+        static constexpr uint32_t CLICK_MASK = (1 << 7) - 1;
+
+        struct Slot {
+            std::atomic<uint64_t> keyXorData;
+            std::atomic<uint64_t> data;
+        };
+
+        struct alignas(64) Bucket {
+            Slot slots[WAYS];
+        };
+
+        Bucket *buckets = nullptr;
+        size_t numBuckets = 0;
+        uint32_t epoch = 1;
+        uint32_t firstEpoch = 1; // Entries from before the last clear() are ignored
+
+        static uint64_t pack(const Entry &entry) {
+            return uint64_t(entry.moves) | (uint64_t(entry.task & TASK_MASK) << 8) | (uint64_t(entry.lastClick & CLICK_MASK) << 25)
+                    | (uint64_t(entry.epoch & EPOCH_MASK) << 32) | (uint64_t(entry.lowerBound) << 56);
+        }
+
+        static Entry unpack(uint64_t data) {
+            return {uint8_t(data), uint32_t(data >> 8) & TASK_MASK, uint32_t(data >> 32) & EPOCH_MASK,
+                    uint8_t(data >> 56), uint8_t((data >> 25) & CLICK_MASK)};
+        }
+
+        /**
+         * How much we want to keep an entry. Recent entries beat old ones,
+         * and within an epoch, states close to the root beat deep ones as they cut off more.
+         */
+        [[nodiscard]] uint64_t worth(const Entry &entry) const {
+            if (entry.epoch < firstEpoch) {
+                return 0;
+            }
+            return (uint64_t(entry.epoch) << 8) | (255 - entry.moves);
+        }
+
+    public:
+        /**
+         * Uses the largest power of two number of buckets that fits into the given memory budget.
+         */
+        explicit TranspositionTable(size_t bytes) {
+            numBuckets = std::bit_floor(std::max(bytes / sizeof(Bucket), size_t(1)));
+            void *memory = mmap(nullptr, numBuckets * sizeof(Bucket), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (memory == MAP_FAILED) {
+                std::cout<<"Unable to allocate transposition table"<<std::endl;
+                exit(1);
+            }
+            madvise(memory, numBuckets * sizeof(Bucket), MADV_HUGEPAGE); // Only a hint, failure is fine
+            buckets = static_cast<Bucket *>(memory);
+        }
+
+        ~TranspositionTable() {
+            munmap(buckets, numBuckets * sizeof(Bucket));
+        }
+
+        TranspositionTable(const TranspositionTable &) = delete;
+        TranspositionTable &operator=(const TranspositionTable &) = delete;
+
+        [[nodiscard]] uint32_t currentEpoch() const {
+            return epoch;
+        }
+
+        bool probe(uint64_t key, Entry &entry) const {
+            const Bucket &bucket = buckets[key & (numBuckets - 1)];
+            for (const Slot &slot : bucket.slots) {
+                uint64_t data = slot.data.load(std::memory_order_relaxed);
+                uint64_t keyXorData = slot.keyXorData.load(std::memory_order_relaxed);
+                if ((keyXorData ^ data) == key) {
+                    entry = unpack(data);
+                    return entry.epoch >= firstEpoch;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Stores the entry with the current epoch, replacing the entry of the same key
+         * or the least valuable entry of the bucket. Returns true if that evicted another state.
+         */
+        bool store(uint64_t key, Entry entry) {
+            entry.epoch = epoch;
+            Bucket &bucket = buckets[key & (numBuckets - 1)];
+            Slot *victim = nullptr;
+            uint64_t victimWorth = UINT64_MAX;
+            for (Slot &slot : bucket.slots) {
+                uint64_t data = slot.data.load(std::memory_order_relaxed);
+                uint64_t keyXorData = slot.keyXorData.load(std::memory_order_relaxed);
+                if ((keyXorData ^ data) == key) {
+                    victim = &slot;
+                    victimWorth = 0; // Not another state
+                    break;
+                }
+                uint64_t slotWorth = worth(unpack(data));
+                if (slotWorth < victimWorth) {
+                    victim = &slot;
+                    victimWorth = slotWorth;
+                }
+            }
+            uint64_t data = pack(entry);
+            victim->data.store(data, std::memory_order_relaxed);
+            victim->keyXorData.store(key ^ data, std::memory_order_relaxed);
+            return victimWorth != 0;
+        }
+
+        /**
+         * Writes every bucket that has been used to the file, while other threads may still
+         * store into the table. Torn slots are rejected on load like on probe(), and every
+         * entry that survives is as valid as it was in the table.
+         */
+        void save(const std::filesystem::path &path) const {
+            std::filesystem::path temporary = path;
+            temporary += ".tmp";
+            FILE *file = fopen(temporary.c_str(), "wb");
+            if (file == nullptr) {
+                std::cout<<"Unable to create "<<temporary<<std::endl;
+                exit(1);
+            }
+            uint64_t header[2] = {numBuckets, firstEpoch};
+            bool ok = fwrite(header, sizeof(uint64_t), std::size(header), file) == std::size(header);
+            for (size_t index = 0; index < numBuckets && ok; index++) {
+                uint64_t record[1 + 2 * WAYS] = {index};
+                bool used = false;
+                for (size_t way = 0; way < WAYS; way++) {
+                    record[1 + 2 * way] = buckets[index].slots[way].keyXorData.load(std::memory_order_relaxed);
+                    record[2 + 2 * way] = buckets[index].slots[way].data.load(std::memory_order_relaxed);
+                    used |= record[2 + 2 * way] != 0;
+                }
+                if (used) {
+                    ok = fwrite(record, sizeof(uint64_t), std::size(record), file) == std::size(record);
+                }
+            }
+            if (fclose(file) != 0 || !ok) {
+                std::cout<<"Unable to write "<<temporary<<std::endl;
+                exit(1);
+            }
+            std::filesystem::rename(temporary, path);
+        }
+
+        /**
+         * Clears the table and fills it with the lower bounds saved to the file. Tasks that were
+         * interrupted by the save start over, so the moves that states were reached with no longer
+         * say who is searching them: entries come back as reached with the most moves possible.
+         * Returns false if there is no such file or it was saved by a table of a different size.
+         */
+        bool load(const std::filesystem::path &path) {
+            FILE *file = fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                return false;
+            }
+            uint64_t header[2];
+            if (fread(header, sizeof(uint64_t), std::size(header), file) != std::size(header) || header[0] != numBuckets) {
+                fclose(file);
+                return false;
+            }
+            clear();
+            uint64_t record[1 + 2 * WAYS];
+            while (fread(record, sizeof(uint64_t), std::size(record), file) == std::size(record)) {
+                Bucket &bucket = buckets[record[0] & (numBuckets - 1)];
+                for (size_t way = 0; way < WAYS; way++) {
+                    uint64_t data = record[2 + 2 * way];
+                    uint64_t key = record[1 + 2 * way] ^ data;
+                    Entry entry = unpack(data);
+                    if (entry.epoch < header[1]) {
+                        continue; // Already dropped, or never used
+                    }
+                    entry.moves = UINT8_MAX;
+                    entry.epoch = epoch;
+                    data = pack(entry);
+                    bucket.slots[way].data.store(data, std::memory_order_relaxed);
+                    bucket.slots[way].keyXorData.store(key ^ data, std::memory_order_relaxed);
+                }
+            }
+            fclose(file);
+            return true;
+        }
+
+        void clear() {
+            nextEpoch();
+            firstEpoch = epoch;
+        }
+
+        void nextEpoch() {
+            epoch++;
+            if (epoch > EPOCH_MASK) {
+                // Packed epochs would wrap around, so old entries have to go for real.
+                // Dropping the pages makes them read as zero again.
+                madvise(buckets, numBuckets * sizeof(Bucket), MADV_DONTNEED);
+                epoch = 1;
+                firstEpoch = 1;
+            }
+        }
+};
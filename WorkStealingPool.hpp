@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs a fixed list of tasks on a number of threads. Tasks are dealt round-robin, every
+ * thread works through its own deque from the front (lowest task first) and steals from
+ * the back of the other deques once it runs dry.
+ */
+class WorkStealingPool {
+        struct Worker {
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+
+        size_t numThreads;
+        std::unique_ptr<Worker[]> workers;
+
+        bool popOwn(size_t thread, size_t &task) {
+            Worker &worker = workers[thread];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.tasks.empty()) {
+                return false;
+            }
+            task = worker.tasks.front();
+            worker.tasks.pop_front();
+            return true;
+        }
+
+        bool steal(size_t thread, size_t &task) {
+            for (size_t i = 1; i < numThreads; i++) {
+                Worker &victim = workers[(thread + i) % numThreads];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    task = victim.tasks.back();
+                    victim.tasks.pop_back();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    public:
+        explicit WorkStealingPool(size_t numThreads)
+                : numThreads(numThreads), workers(std::make_unique<Worker[]>(numThreads)) {
+
+        }
+
+        /**
+         * Calls execute(task, thread) for every task in [0, numTasks) and returns once all are done.
+         */
+        template<typename F>
+        void run(size_t numTasks, F execute) {
+            for (size_t task = 0; task < numTasks; task++) {
+                workers[task % numThreads].tasks.push_back(task);
+            }
+            std::vector<std::thread> threads;
+            for (size_t thread = 0; thread < numThreads; thread++) {
+                threads.emplace_back([this, thread, &execute] {
+                    size_t task;
+                    // No task creates new tasks, so once every deque is empty we are done
+                    while (popOwn(thread, task) || steal(thread, task)) {
+                        execute(task, thread);
+                    }
+                });
+            }
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+        }
+};
@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+#include "Board.hpp"
+#include "MappedFile.hpp"
+#include "SimpleXml.hpp"
+#include "BfsSolver.hpp"
+#include "BranchBoundSolver.hpp"
+
+/**
+ * Measures the kernels of the search in ns/op and whole solves in seconds and nodes,
+ * and compares the results with those of an earlier run. See `make bench` in the README.
+ */
+
+struct Result {
+    std::string name;
+    double value;
+    std::string unit; // ns/op, s, nodes or moves
+};
+
+struct BenchmarkOptions {
+    SolverOptions solver;
+    size_t ttMegabytes = 1024;
+    size_t repeat = 3; // Solves keep their fastest run
+    double tolerance = 0.1; // Slowdown that counts as a regression
+    bool bfs = false;
+};
+
+/**
+ * Keeps the compiler from dropping a computation whose result is never used.
+ */
+template<typename T>
+void keep(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+std::string format(const Result &result) {
+    std::ostringstream out;
+    if (result.unit == "ns/op") {
+        out<<std::fixed<<std::setprecision(2);
+    } else if (result.unit == "s") {
+        out<<std::fixed<<std::setprecision(4);
+    } else {
+        out<<std::fixed<<std::setprecision(0);
+    }
+    out<<result.value;
+    return out.str();
+}
+
+void print(const Result &result, std::ostream &out = std::cout) {
+    out<<result.name<<"\t"<<format(result)<<"\t"<<result.unit<<std::endl;
+}
+
+/**
+ * Runs f (which performs ops operations) until it took at least 50ms, five times over,
+ * and returns the fastest time per operation. The fastest run is the one least disturbed
+ * by everything else on the machine.
+ */
+template<typename F>
+double nanosecondsPerOp(size_t ops, F f) {
+    f(); // Warm up caches and branch predictors
+    double best = 1e30;
+    for (size_t run = 0; run < 5; run++) {
+        size_t rounds = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::chrono::duration<double, std::nano> elapsed;
+        do {
+            f();
+            rounds++;
+            elapsed = std::chrono::steady_clock::now() - start;
+        } while (elapsed.count() < 50e6);
+        best = std::min(best, elapsed.count() / (rounds * ops));
+    }
+    return best;
+}
+
+/**
+ * Kernels on boards of one size. The boards are taken from random walks through the levels,
+ * so they look like the ones the search sees rather than just the initial ones.
+ */
+template<size_t rows, size_t cols>
+void benchmarkKernels(const std::vector<LevelRecord> &levels, std::vector<Result> &results) {
+    std::vector<std::unique_ptr<BoardLayout<rows, cols>>> layouts;
+    std::vector<Board<rows, cols>> boards;
+    std::vector<Position> clicks; // One clickable of each board
+    std::mt19937_64 random(42);
+    for (const LevelRecord &record : levels) {
+        if (record.color.length() != rows * cols) {
+            continue;
+        }
+        layouts.push_back(std::make_unique<BoardLayout<rows, cols>>());
+        Board<rows, cols> board = Board<rows, cols>::from(record.color, record.modifier, *layouts.back());
+        for (size_t step = 0; step < 256; step++) {
+            uint64_t clickable = board.clickableCells();
+            if (!clickable) {
+                break;
+            }
+            for (size_t skip = random() % std::popcount(clickable); skip > 0; skip--) {
+                clickable &= clickable - 1;
+            }
+            size_t cell = std::countr_zero(clickable);
+            boards.push_back(board);
+            clicks.push_back(Position(cell / cols, cell % cols));
+            Undo undo; // Walks are longer than any MoveSequence
+            board.make(cell / cols, cell % cols, undo);
+        }
+    }
+    if (boards.empty()) {
+        return;
+    }
+    std::string size = std::to_string(rows) + "x" + std::to_string(cols) + "/";
+
+    results.push_back({size + "click", nanosecondsPerOp(boards.size(), [&] {
+        for (size_t i = 0; i < boards.size(); i++) {
+            Board<rows, cols> board = boards[i];
+            board.click(clicks[i].row, clicks[i].col);
+            keep(board);
+        }
+    }), "ns/op"});
+    results.push_back({size + "make+unmake", nanosecondsPerOp(boards.size(), [&] {
+        for (size_t i = 0; i < boards.size(); i++) {
+            Undo undo;
+            boards[i].make(clicks[i].row, clicks[i].col, undo);
+            keep(boards[i]);
+            boards[i].unmake(undo);
+        }
+    }), "ns/op"});
+    results.push_back({size + "computeHash", nanosecondsPerOp(boards.size(), [&] {
+        for (const Board<rows, cols> &board : boards) {
+            keep(board.computeHash());
+        }
+    }), "ns/op"});
+    results.push_back({size + "minStepsNeeded", nanosecondsPerOp(boards.size(), [&] {
+        for (const Board<rows, cols> &board : boards) {
+            keep(minStepsNeeded(board));
+        }
+    }), "ns/op"});
+    results.push_back({size + "isSolved", nanosecondsPerOp(boards.size(), [&] {
+        for (const Board<rows, cols> &board : boards) {
+            keep(board.isSolved());
+        }
+    }), "ns/op"});
+}
+
+/**
+ * Solves every level, repeat times, and keeps the fastest run. Node counts and solution lengths
+ * do not change between runs with one thread. Returns false if a level with a solution in the
+ * file got a solution of a different length.
+ */
+bool benchmarkSolves(const std::vector<LevelRecord> &levels, const BenchmarkOptions &options,
+                     std::vector<Result> &results) {
+    TranspositionTable table(options.ttMegabytes << 20);
+    std::ostream discard(nullptr);
+    std::string prefix = options.bfs ? "bfs/" : "solve/";
+    double total = 0;
+    bool ok = true;
+    for (const LevelRecord &record : levels) {
+        double best = 1e30;
+        SolveStats stats;
+        size_t moves = 0;
+        for (size_t run = 0; run < options.repeat; run++) {
+            stats = SolveStats();
+            auto start = std::chrono::steady_clock::now();
+            moves = withBoardSize(record.color.length(), [&]<size_t rows, size_t cols>() {
+                BoardLayout<rows, cols> layout;
+                Board<rows, cols> board = Board<rows, cols>::from(record.color, record.modifier, layout);
+                Board<rows, cols> solved = options.bfs
+                        ? solveBFS(record.number, board, options.solver.threads, discard, &stats)
+                        : solveBranchAndBound(record.number, board, table, options.solver, discard, &stats);
+                return solved.isSolved() ? solved.moveSequence.n : size_t(0);
+            });
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            best = std::min(best, seconds.count());
+        }
+        total += best;
+        size_t first = results.size();
+        std::string name = prefix + std::to_string(record.number) + "/";
+        results.push_back({name + "seconds", best, "s"});
+        if (!options.bfs) {
+            results.push_back({name + "nodes", double(stats.search.nodes), "nodes"});
+        }
+        results.push_back({name + "moves", double(moves), "moves"});
+        for (size_t i = first; i < results.size(); i++) {
+            print(results[i]);
+        }
+        size_t expected = std::count(record.solution.begin(), record.solution.end(), ',') + 1;
+        if (!record.solution.empty() && moves != expected) {
+            std::cout<<name<<"moves should be "<<expected<<std::endl;
+            ok = false;
+        }
+    }
+    results.push_back({prefix + "total/seconds", total, "s"});
+    print(results.back());
+    return ok;
+}
+
+std::vector<Result> readResults(const char *path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cout<<"Unable to read "<<path<<std::endl;
+        exit(1);
+    }
+    std::vector<Result> results;
+    Result result;
+    while (in>>result.name>>result.value>>result.unit) {
+        results.push_back(result);
+    }
+    return results;
+}
+
+/**
+ * Prints every result next to the one of the baseline run. Returns false if anything got slower
+ * by more than the tolerance, searched more nodes or found a solution of a different length.
+ * Solves that take a few milliseconds are too noisy to judge by their time.
+ */
+bool compare(const std::vector<Result> &baseline, const std::vector<Result> &results, double tolerance) {
+    std::unordered_map<std::string, double> before;
+    for (const Result &result : baseline) {
+        before[result.name] = result.value;
+    }
+    bool ok = true;
+    std::cout<<std::left<<std::setw(28)<<"name"<<std::right<<std::setw(14)<<"baseline"
+             <<std::setw(14)<<"current"<<std::setw(10)<<"change"<<std::endl;
+    for (const Result &result : results) {
+        auto it = before.find(result.name);
+        if (it == before.end()) {
+            continue;
+        }
+        double old = it->second;
+        double change = old > 0 ? (result.value - old) / old : (result.value > 0 ? 1 : 0);
+        bool noticeable = result.unit != "s" || std::abs(result.value - old) > 0.005;
+        std::string verdict;
+        if (result.unit == "moves") {
+            if (result.value != old) {
+                verdict = "  DIFFERENT";
+                ok = false;
+            }
+        } else if (change > tolerance && noticeable) {
+            verdict = "  REGRESSION";
+            ok = false;
+        } else if (change < -tolerance && noticeable) {
+            verdict = "  faster";
+        }
+        std::ostringstream percent;
+        percent<<std::showpos<<std::fixed<<std::setprecision(1)<<100 * change<<"%";
+        std::cout<<std::left<<std::setw(28)<<result.name<<std::right<<std::setw(14)<<format({"", old, result.unit})
+                 <<std::setw(14)<<format(result)<<std::setw(10)<<percent.str()<<verdict<<std::endl;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    const char *path = nullptr;
+    const char *savePath = nullptr;
+    const char *baselinePath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            options.solver.threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--tt-mb" && i + 1 < argc) {
+            options.ttMegabytes = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            options.repeat = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            options.tolerance = std::max(0, atoi(argv[++i])) / 100.0;
+        } else if (arg == "--bfs") {
+            options.bfs = true;
+        } else if (arg == "--save" && i + 1 < argc) {
+            savePath = argv[++i];
+        } else if (arg == "--compare" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (path == nullptr) {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (path == nullptr) {
+        std::cout<<"Usage: benchmark [-j threads] [--tt-mb megabytes] [--repeat n] [--bfs] [--save file]"
+                 <<" [--compare file] [--tolerance percent] levels.xml"<<std::endl;
+        exit(1);
+    }
+    std::vector<Result> baseline;
+    if (baselinePath != nullptr) {
+        baseline = readResults(baselinePath); // Before running, in case it is missing
+    }
+    MappedFile file(path);
+    std::string_view xml = file.contents();
+    size_t pos = 0;
+    SimpleXml::parseHeader(xml, pos);
+    std::vector<LevelRecord> levels;
+    LevelRecord record;
+    while (SimpleXml::parseLevel(xml, pos, record)) {
+        levels.push_back(record);
+    }
+
+    std::vector<Result> results;
+    benchmarkKernels<8, 6>(levels, results);
+    benchmarkKernels<6, 5>(levels, results);
+    for (const Result &result : results) {
+        print(result);
+    }
+    bool solved = benchmarkSolves(levels, options, results);
+
+    if (savePath != nullptr) {
+        std::ofstream out(savePath);
+        for (const Result &result : results) {
+            print(result, out);
+        }
+        if (!out) {
+            std::cout<<"Unable to write "<<savePath<<std::endl;
+            exit(1);
+        }
+    }
+    if (baselinePath != nullptr && !compare(baseline, results, options.tolerance)) {
+        exit(1);
+    }
+    if (!solved) {
+        exit(1);
+    }
+}
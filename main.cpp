@@ -1,50 +1,304 @@
-#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <fstream>
-#include "MurmurHash64.hpp"
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <sstream>
 #include "Board.hpp"
+#include "MappedFile.hpp"
 #include "SimpleXml.hpp"
 #include "BfsSolver.hpp"
+#include "ExternalBfsSolver.hpp"
 #include "BranchBoundSolver.hpp"
+#include "SolutionCache.hpp"
+
+struct Level {
+    size_t indexInFile;
+    LevelRecord record;
+};
+
+/**
+ * Where --stats writes the SolveStats of every level, one JSON object per line.
+ */
+struct StatsFile {
+    std::ofstream out;
+    std::mutex mutex; // Levels can be solved in parallel
+};
+
+template<size_t rows, size_t cols>
+void solveLevelOfSize(const Level &level, TranspositionTable &table, const SolverOptions &options, std::ostream &out,
+                      StatsFile *statsFile, SolutionCache *cache) {
+    size_t levelNr = level.record.number;
+    BoardLayout<rows, cols> layout;
+    Board<rows, cols> board = Board<rows, cols>::from(level.record.color, level.record.modifier, layout);
+
+    auto start = std::chrono::steady_clock::now();
+    SolveStats stats;
+    stats.levelNr = levelNr;
+    Board<rows, cols> solvedBoard;
+    std::string encoding = board.encode();
+    SolutionCache::Entry cached;
+    bool hit = cache != nullptr && cache->find(encoding, cached);
+    if (hit && (cached.status == SolveStatus::OPTIMAL || !cached.solution.empty()) && !solves(board, cached.solution)) {
+        // Written by a broken run, so nothing else in it can be trusted either
+        out<<"# Cached solution does not solve "<<levelNr<<", solving it again"<<std::endl;
+        cache->forget(encoding);
+        hit = false;
+    }
+    if (hit && cached.finished()) {
+        out<<"# Cached as "<<toString(cached.status)<<std::endl;
+        solvedBoard = cached.solution.empty() ? Board<rows, cols>() : replay(board, cached.solution);
+        stats.status = cached.status;
+        stats.lowerBound = cached.lowerBound;
+    } else if (options.bfs || !options.bfsDirectory.empty()) {
+        // Without limits, but the one in memory gives up (as unknown) when there are too many states
+        if (options.bfs) {
+            solvedBoard = solveBFS(levelNr, board, options.threads, out, &stats);
+        } else {
+            solvedBoard = solveExternalBFS(levelNr, board, options.bfsDirectory, options.bfsMemoryMegabytes << 20, out, &stats);
+        }
+    } else {
+        SolverOptions levelOptions = options;
+        levelOptions.lowerBound = hit ? cached.lowerBound : 0;
+        solvedBoard = solveBranchAndBound(levelNr, board, table, levelOptions, out, &stats);
+    }
+    stats.moves = solvedBoard.isSolved() ? solvedBoard.moveSequence.n : 0;
+    // An optimal result that does not solve the level would be trusted by every later run
+    if (cache != nullptr && (stats.status != SolveStatus::OPTIMAL || solvedBoard.isSolved())) {
+        // A solution of an earlier run that is shorter than the one of this run, or a lower bound
+        // that now meets it, can turn this result into a better one
+        SolutionCache::Entry merged = cache->store(encoding, {stats.status, stats.lowerBound,
+                                                              solvedBoard.isSolved() ? solvedBoard.moveSequence.toString() : ""});
+        if (merged.moves() < stats.moves || merged.status != stats.status) {
+            solvedBoard = merged.solution.empty() ? Board<rows, cols>() : replay(board, merged.solution);
+            stats.moves = solvedBoard.isSolved() ? solvedBoard.moveSequence.n : 0;
+            stats.status = merged.status;
+            stats.lowerBound = merged.lowerBound;
+        }
+    }
+    if (statsFile != nullptr) {
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        stats.seconds = seconds.count();
+        std::lock_guard<std::mutex> lock(statsFile->mutex);
+        stats.writeJson(statsFile->out);
+        statsFile->out.flush(); // Complete lines only, in case the run is stopped
+    }
+
+    if (stats.status == SolveStatus::UNSOLVABLE) {
+        out<<"# Unable to solve "<<levelNr<<std::endl;
+        board.print(out);
+    } else if (stats.status == SolveStatus::UNKNOWN) {
+        out<<"# No solution for "<<levelNr<<" within the limits, lower bound "<<stats.lowerBound<<std::endl;
+        board.print(out);
+    } else if (stats.status == SolveStatus::BOUNDED) {
+        out<<"# Best solution within the limits has "<<solvedBoard.moveSequence.n<<" moves, lower bound "
+           <<stats.lowerBound<<": "<<solvedBoard.moveSequence.toString()<<std::endl;
+        board.print(out);
+    } else {
+        out<<"# Solved with "<<solvedBoard.moveSequence.n<<" moves: "
+           <<solvedBoard.moveSequence.toString()<<std::endl;
+        board.print(out);
+
+        std::string levelnr = "<level number=\""+std::to_string(levelNr)+"\"";
+        std::string replacement = "        solution=\""+solvedBoard.moveSequence.toString()+"\"";
+        out<<"sed -i 's/"<<levelnr<<"/"<<levelnr<<"\\n"<<replacement<<"/' levels.xml";
+    }
+}
+
+void solveLevel(const Level &level, TranspositionTable &table, const SolverOptions &options, std::ostream &out,
+                StatsFile *statsFile, SolutionCache *cache) {
+    out<<"# Level "<<level.indexInFile<<" (id "<<level.record.number<<")"<<std::endl;
+    if (!level.record.solution.empty()) {
+        out<<"# Has solution"<<std::endl;
+    }
+    withBoardSize(level.record.color.length(), [&]<size_t rows, size_t cols>() {
+        solveLevelOfSize<rows, cols>(level, table, options, out, statsFile, cache);
+    });
+    out<<std::endl;
+}
+
+/**
+ * Levels that look hard are started first, so that a long solve does not end up alone at the end.
+ * The heuristic of the initial board is a rough guess for the number of moves,
+ * more clickable cells mean a wider search tree.
+ */
+std::vector<size_t> longestFirst(const std::vector<Level> &levels) {
+    std::vector<std::pair<size_t, size_t>> difficulty;
+    for (const Level &level : levels) {
+        difficulty.push_back(withBoardSize(level.record.color.length(), [&]<size_t rows, size_t cols>() {
+            BoardLayout<rows, cols> layout;
+            Board<rows, cols> board = Board<rows, cols>::from(level.record.color, level.record.modifier, layout);
+            return std::pair<size_t, size_t>(minStepsNeeded(board), std::popcount(board.clickableCells()));
+        }));
+    }
+    std::vector<size_t> order(levels.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return difficulty[a] > difficulty[b];
+    });
+    return order;
+}
+
+/**
+ * Solves multiple levels at the same time. Every level writes into its own buffer,
+ * which is printed as soon as all levels before it in the file are done.
+ */
+void solveLevelsInParallel(const std::vector<Level> &levels, size_t parallelLevels, size_t ttMegabytes,
+                           const SolverOptions &options, StatsFile *statsFile, SolutionCache *cache) {
+    std::vector<std::unique_ptr<TranspositionTable>> tables;
+    for (size_t i = 0; i < parallelLevels; i++) {
+        tables.push_back(std::make_unique<TranspositionTable>((ttMegabytes << 20) / parallelLevels));
+    }
+    std::vector<size_t> order = longestFirst(levels);
+    std::vector<std::string> output(levels.size());
+    std::vector<bool> done(levels.size(), false);
+    size_t nextToPrint = 0;
+    std::mutex outputMutex;
+
+    WorkStealingPool pool(parallelLevels);
+    pool.run(levels.size(), [&](size_t task, size_t thread) {
+        size_t index = order[task];
+        std::ostringstream out;
+        solveLevel(levels[index], *tables[thread], options, out, statsFile, cache);
+        std::lock_guard<std::mutex> lock(outputMutex);
+        output[index] = out.str();
+        done[index] = true;
+        while (nextToPrint < levels.size() && done[nextToPrint]) {
+            std::cout<<output[nextToPrint]<<std::flush;
+            output[nextToPrint].clear();
+            nextToPrint++;
+        }
+    });
+}
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cout<<"Specify a path"<<std::endl;
+    SolverOptions options;
+    size_t ttMegabytes = 1024;
+    size_t parallelLevels = 1;
+    const char *path = nullptr;
+    const char *statsPath = nullptr;
+    const char *cachePath = nullptr;
+    double runTimeLimit = 0;
+    uint64_t runNodeLimit = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            options.threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--tt-mb" && i + 1 < argc) {
+            ttMegabytes = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--bounds" && i + 1 < argc) {
+            std::string policy = argv[++i];
+            if (policy == "ida") {
+                options.boundPolicy = BoundPolicy::IDA;
+            } else if (policy == "steps") {
+                options.boundPolicy = BoundPolicy::STEPS;
+            } else {
+                std::cout<<"Unknown bound policy "<<policy<<std::endl;
+                exit(1);
+            }
+        } else if (arg == "--no-move-pruning") {
+            options.movePruning = false;
+        } else if (arg == "--beam-width" && i + 1 < argc) {
+            options.beamWidth = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--move-ordering") {
+            options.moveOrdering = true;
+        } else if (arg == "--no-pdb") {
+            options.patternDatabase = false;
+        } else if (arg == "--bfs") {
+            options.bfs = true;
+        } else if (arg == "--bfs-dir" && i + 1 < argc) {
+            options.bfsDirectory = argv[++i];
+        } else if (arg == "--bfs-memory-mb" && i + 1 < argc) {
+            options.bfsMemoryMegabytes = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--parallel-levels" && i + 1 < argc) {
+            parallelLevels = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cachePath = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else if (arg == "--time-limit" && i + 1 < argc) {
+            options.timeLimit = std::max(0.0, atof(argv[++i]));
+        } else if (arg == "--node-limit" && i + 1 < argc) {
+            options.nodeLimit = std::max(0LL, atoll(argv[++i]));
+        } else if (arg == "--run-time-limit" && i + 1 < argc) {
+            runTimeLimit = std::max(0.0, atof(argv[++i]));
+        } else if (arg == "--run-node-limit" && i + 1 < argc) {
+            runNodeLimit = std::max(0LL, atoll(argv[++i]));
+        } else if (arg == "--checkpoint-dir" && i + 1 < argc) {
+            options.checkpointDirectory = argv[++i];
+        } else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+            options.checkpointInterval = std::max(0.0, atof(argv[++i]));
+        } else if (arg == "--checkpoint-tt") {
+            options.checkpointTable = true;
+        } else if (arg == "--resume") {
+            options.resume = true;
+        } else if (arg == "--bound-increment" && i + 1 < argc) {
+            options.boundIncrement = std::max(1, atoi(argv[++i]));
+        } else if (path == nullptr) {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (path == nullptr || (options.resume && options.checkpointDirectory.empty())) {
+        std::cout<<"Usage: solver [-j threads] [--tt-mb megabytes] [--bounds ida|steps] [--bound-increment n]"
+                 <<" [--parallel-levels n] [--no-pdb] [--no-move-pruning] [--move-ordering] [--beam-width n] [--bfs]"
+                 <<" [--bfs-dir directory] [--bfs-memory-mb megabytes] [--stats file] [--cache file]"
+                 <<" [--time-limit seconds] [--node-limit n] [--run-time-limit seconds] [--run-node-limit n]"
+                 <<" [--checkpoint-dir directory [--checkpoint-interval seconds] [--checkpoint-tt] [--resume]] levels.xml"<<std::endl;
         exit(1);
     }
-    std::cout<<argv[1]<<std::endl;
-    std::ifstream t(argv[1]);
-    std::string xml((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+    std::cout<<path<<std::endl;
+    MappedFile file(path);
+    std::string_view xml = file.contents();
     size_t pos = 0;
-    SimpleXml::consume("<?xml version=\"1.0\" encoding=\"utf-8\" ?>", xml, pos);
-    SimpleXml::skipWhitespace(xml, pos);
-    SimpleXml::consume("<levels>", xml, pos);
-
-    size_t indexInFile = 0;
-    while (true) {
-        indexInFile++;
-        auto [levelNr, color, modifier, hasSolution] = SimpleXml::parseBoardXml(xml, pos);
-        std::cout<<"# Level "<<indexInFile<<" (id "<<levelNr<<")"<<std::endl;
-        if (hasSolution) {
-            std::cout<<"# Has solution"<<std::endl;
-            //continue;
+    SimpleXml::parseHeader(xml, pos);
+
+    std::vector<Level> levels;
+    LevelRecord record;
+    while (SimpleXml::parseLevel(xml, pos, record)) {
+        levels.push_back({levels.size() + 1, record});
+    }
+
+    SearchLimits runLimits(runTimeLimit, runNodeLimit); // Starts counting now, after parsing the levels
+    if (runTimeLimit > 0 || runNodeLimit > 0) {
+        options.runLimits = &runLimits;
+    }
+
+    if (!options.checkpointDirectory.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(options.checkpointDirectory, error);
+        if (error) {
+            std::cout<<"Unable to create "<<options.checkpointDirectory<<std::endl;
+            exit(1);
         }
-        Board board = Board::from(color, modifier);
+    }
 
-        //Board solvedBoard = solveBFS(levelNr, board);
-        Board solvedBoard = solveBranchAndBound(levelNr, board);
+    std::unique_ptr<StatsFile> statsFile;
+    if (statsPath != nullptr) {
+        statsFile = std::make_unique<StatsFile>();
+        statsFile->out.open(statsPath);
+        if (!statsFile->out) {
+            std::cout<<"Unable to create "<<statsPath<<std::endl;
+            exit(1);
+        }
+    }
 
-        if (!solvedBoard.isSolved()) {
-            std::cout<<"# Unable to solve "<<levelNr<<std::endl;
-            board.print();
-        } else {
-            std::cout<<"# Solved with "<<solvedBoard.moveSequence.n<<" moves: "
-                     <<solvedBoard.moveSequence.toString()<<std::endl;
-            board.print();
+    std::unique_ptr<SolutionCache> cache;
+    if (cachePath != nullptr) {
+        cache = std::make_unique<SolutionCache>(cachePath);
+    }
 
-            std::string levelnr = "<level number=\""+std::to_string(levelNr)+"\"";
-            std::string replacement = "        solution=\""+solvedBoard.moveSequence.toString()+"\"";
-            std::cout<<"sed -i 's/"<<levelnr<<"/"<<levelnr<<"\\n"<<replacement<<"/' levels.xml";
+    if (parallelLevels > 1) {
+        solveLevelsInParallel(levels, parallelLevels, ttMegabytes, options, statsFile.get(), cache.get());
+    } else {
+        TranspositionTable table(ttMegabytes << 20);
+        for (const Level &level : levels) {
+            solveLevel(level, table, options, std::cout, statsFile.get(), cache.get());
         }
-        std::cout<<std::endl;
     }
 }